@@ -0,0 +1,89 @@
+/****************************************************************************************
+ *
+ * PURPOSE: Example of the in-memory interface to the library (library.hpp), linked
+ *          against liboverlap.a as another program would be. A System is made from
+ *          arrays, its overlap calculated and read through a view, and then copied,
+ *          grown and moved, checking that copies share nothing that either changes.
+ *
+ *          Usage: ./benchmark/libexample
+ *
+ *          Prints one line per check, and exits with 1 if any fails.
+ *
+ * DATE            AUTHOR             CHANGES
+ * ==============================================================================
+ * 19/10/26        agent              Original code.
+ *
+ ****************************************************************************************/
+
+#include "../library.hpp"
+#include "../gaussian.hpp"
+#include "../storage.hpp"
+#include <iostream>
+#include <vector>
+#include <utility>
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+	std::cout << (ok ? "ok      " : "FAILED  ") << what << "\n";
+	if (!ok) failures++;
+}
+
+// All the rows of sys, as read through a RowReader, so compressed rows can be compared
+static std::vector<std::vector<double> > allRows(const System& sys)
+{
+	std::vector<std::vector<double> > rows(sys.getN());
+	RowReader reader(sys);
+	for (int i = 0; i < sys.getN(); i++){
+		int count = reader.read(i);
+		rows[i].assign(reader.vals, reader.vals + count);
+	}
+	return rows;
+}
+
+int main()
+{
+	// A chain of hydrogen-like gaussians, close enough to overlap their neighbours
+	const int n = 40;
+	std::vector<double> coords(3*n, 0.0), zetas(n, 0.5);
+	for (int i = 0; i < n; i++) coords[3*i] = 1.2*i;
+
+	System sys = makeSystem(n, coords.data(), zetas.data(), 1e-8);
+	sys.calcOverlap();
+	OverlapView view;
+	check(viewOverlap(sys, view) && view.N == n && view.nonzero == sys.getNonZero(),
+		  "overlap viewed in place");
+
+	// A copy is grown, leaving the original as it was
+	std::vector<std::vector<double> > before = allRows(sys);
+	System copy = sys;
+	copy.addGaussian(Gaussian(0.5, 1.2*n, 0.0, 0.0));
+	check(copy.getN() == n + 1 && sys.getN() == n && allRows(sys) == before,
+		  "growing a copy leaves the original unchanged");
+
+	// The same, with the compressed integrals shared between them
+	System packed = makeSystem(n, coords.data(), zetas.data(), 1e-8);
+	packed.setCompression(true);
+	packed.calcOverlap();
+	std::vector<std::vector<double> > packedBefore = allRows(packed);
+	System packedCopy = packed;
+	int mark = packedCopy.snapshot();
+	packedCopy.addGaussian(Gaussian(0.5, 1.2*n, 0.0, 0.0));
+	packedCopy.rollback(mark - 5);
+	check(packedCopy.getN() == n - 5 && allRows(packed) == packedBefore,
+		  "rolling back a copy leaves the shared compressed integrals unchanged");
+
+	// A move takes everything, so the moved-to System is the grown one
+	System moved = std::move(copy);
+	check(moved.getN() == n + 1 && moved.hasOverlap() && allRows(moved).size() == n + 1,
+		  "moved system keeps its integrals");
+	moved.rollback(n);
+	check(allRows(moved) == before, "moved system rolls back to the original");
+
+	// A moved-from System can be assigned to again
+	copy = sys;
+	check(copy.getN() == n && allRows(copy) == allRows(sys), "moved-from system assigned again");
+
+	return (failures > 0 ? 1 : 0);
+}
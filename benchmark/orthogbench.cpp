@@ -0,0 +1,140 @@
+/****************************************************************************************
+ *
+ * PURPOSE: Benchmark of the orthogonalisation routines, reporting the time taken and
+ *          the peak memory used by each method on an n x n overlap matrix, both with
+ *          structured (identity) coefficients and with a dense coefficient matrix.
+ *          The methods needing an eigendecomposition are run with both Eigen's
+ *          eigensolver and the parallel one.
+ *
+ *          Usage: ./benchmark/orthogbench [n]    (default n = 5000)
+ *
+ *          Each case runs in its own child process, so that the peak resident
+ *          memory reported is that of the case alone. The overlap matrix is that
+ *          of n s-type Gaussians on a simple cubic lattice.
+ *
+ * DATE            AUTHOR             CHANGES
+ * ==============================================================================
+ * 18/10/26        agent              Original code.
+ * 18/10/26        agent              Parallel eigensolver cases.
+ *
+ ****************************************************************************************/
+
+#include "../system.hpp"
+#include "../gaussian.hpp"
+#include "../factorise.hpp"
+#include "../orthogonalise.hpp"
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Peak resident memory of this process so far, in MB
+double peakMemory()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	return usage.ru_maxrss / (1024.0*1024.0); // Bytes
+#else
+	return usage.ru_maxrss / 1024.0; // Kilobytes
+#endif
+}
+
+// Seconds since start
+double elapsed(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Build the system, factorise, then orthogonalise, printing one line of results
+void runCase(int n, int method, bool denseP, int solver)
+{
+	// Gaussians on a cubic lattice, spaced so that S is well conditioned
+	System sys(1e-10);
+	int side = (int) ceil(cbrt((double) n));
+	for (int i = 0; i < n; i++)
+		sys.addGaussian(Gaussian(0.5, 1.5*(i%side), 1.5*((i/side)%side), 1.5*(i/(side*side))));
+	sys.calcOverlap();
+
+	FactorCache& factors = sys.getFactors();
+	factors.overlap(sys, n);
+	Eigen::MatrixXd f = Eigen::MatrixXd::Ones(n, n); // Non-zero, so already resident
+	Eigen::MatrixXd Pdense;
+	if (denseP) Pdense = Eigen::MatrixXd::Identity(n, n);
+	double setupMemory = peakMemory();
+
+	// Factorise
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::shared_ptr<const Eigen::MatrixXd> L;
+	std::shared_ptr<const EigenPairs> eig;
+	if (method == GRAM_SCHMIDT) L = factors.cholesky(sys, n);
+	else eig = factors.eigen(sys, n, solver);
+	double factorTime = elapsed(start);
+	double factorMemory = peakMemory();
+
+	// Orthogonalise
+	start = std::chrono::steady_clock::now();
+	Coefficients P = (denseP ? Coefficients(Pdense) : Coefficients(n));
+	switch(method){
+	case GRAM_SCHMIDT: { gramSchmidt(*L, P, f); break; }
+	case CANONICAL: { canonical(*eig, P, f); break; }
+	default: symLowdin(*eig, P, f);
+	}
+	double orthogTime = elapsed(start);
+
+	std::string name = (method == GRAM_SCHMIDT ? "gramschmidt" :
+						(method == CANONICAL ? "canonical" : "symlowdin"));
+	std::cout << std::setw(14) << name
+			  << std::setw(10) << (denseP ? "dense" : "identity")
+			  << std::setw(10) << (method == GRAM_SCHMIDT ? "-" :
+								   (solver == PARALLEL_EIGEN ? "parallel" : "eigen"))
+			  << std::setw(14) << factorTime
+			  << std::setw(14) << orthogTime
+			  << std::setw(14) << factorMemory - setupMemory
+			  << std::setw(14) << peakMemory() - factorMemory
+			  << std::setw(14) << peakMemory() << std::endl;
+}
+
+int main(int argc, char* argv[])
+{
+	int n = (argc > 1 ? std::stoi(argv[1]) : 5000);
+
+	std::cout << "Orthogonalisation benchmark, n = " << n
+			  << " (a dense n x n matrix is " << 8.0*n*n/(1024.0*1024.0) << " MB)\n\n"
+			  << std::setw(14) << "Method"
+			  << std::setw(10) << "P"
+			  << std::setw(10) << "Solver"
+			  << std::setw(14) << "Factor (s)"
+			  << std::setw(14) << "Orthog (s)"
+			  << std::setw(14) << "Factor (MB)"
+			  << std::setw(14) << "Orthog (MB)"
+			  << std::setw(14) << "Peak (MB)" << "\n"
+			  << std::string(104, '.') << "\n" << std::setprecision(4);
+
+	const int methods[3] = { GRAM_SCHMIDT, CANONICAL, SYM_LOWDIN };
+	for (int m = 0; m < 3; m++){
+		int solvers = (methods[m] == GRAM_SCHMIDT ? 1 : 2);
+		for (int solver = 0; solver < solvers; solver++){
+			for (int dense = 0; dense < 2; dense++){
+				std::cout.flush(); // So the child does not inherit buffered output
+				pid_t pid = fork();
+				if (pid == 0) {
+					runCase(n, methods[m], dense == 1, solver == 0 ? SERIAL_EIGEN : PARALLEL_EIGEN);
+					_exit(0);
+				}
+				int status;
+				waitpid(pid, &status, 0);
+				if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+					std::cerr << "Benchmark case failed.\n";
+			}
+		}
+	}
+
+	std::cout << "\nFactor/Orthog (MB) are the growth in peak memory over each stage,\n"
+			  << "beyond the overlap matrix and the n x n output.\n";
+	return 0;
+}
@@ -0,0 +1,135 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement the cross-overlap of two systems, and class OverlapComparer
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ *
+ ***************************************************************************************/
+
+#include "compare.hpp"
+#include "system.hpp"
+#include "gaussian.hpp"
+#include "tasks.hpp"
+#include <algorithm>
+
+// Cell size of a spatial index when no pair of Gaussians can reach the
+// threshold, so that the cutoff radius is zero
+const double MIN_CELL = 1.0;
+
+// Candidates handed to a thread at a time by compareAll, so that the threads
+// stay busy even if the candidates differ in size
+const int COMPARE_BATCH = 16;
+
+static double cellSize(double radius)
+{
+	return (radius > 0.0 ? radius : MIN_CELL);
+}
+
+// Sum the elements <a_i|b_j> at or above threshold, over each b_j and the Gaussians
+// of A within radius of it, found with indexA. If A and B are the same system, only
+// the pairs with i <= j are calculated, those off the diagonal counting twice.
+static double screenedTotal(const System& A, const SpatialIndex& indexA, const System& B,
+							double radius, double threshold, long long& nonzero,
+							std::vector<int>& near)
+{
+	bool self = (&A == &B);
+	double total = 0.0;
+	nonzero = 0;
+	for (int j = 0; j < B.getN(); j++){
+		const Gaussian& b = B.getGaussian(j);
+		near.clear();
+		indexA.near(A, b.getCoord(0), b.getCoord(1), b.getCoord(2), radius, near);
+		for (int p = 0; p < near.size(); p++){
+			int i = near[p];
+			if (self && i > j) continue;
+			double s = A.getGaussian(i).overlap(b);
+			if (s < threshold) continue;
+			if (self && i < j) { total += 2.0*s; nonzero += 2; }
+			else { total += s; nonzero++; }
+		}
+	}
+	return total;
+}
+
+// Each row is found by searching a spatial index of B around a_i
+void crossOverlap(const System& A, const System& B, double threshold, CrossOverlap& S)
+{
+	double radius = cutoffRadius(A, B, threshold);
+	SpatialIndex indexB(B, cellSize(radius));
+
+	S.rowStart.assign(1, 0);
+	S.cols.clear();
+	S.vals.clear();
+	S.total = 0.0;
+
+	std::vector<int> near;
+	for (int i = 0; i < A.getN(); i++){
+		const Gaussian& a = A.getGaussian(i);
+		near.clear();
+		indexB.near(B, a.getCoord(0), a.getCoord(1), a.getCoord(2), radius, near);
+		std::sort(near.begin(), near.end());
+		for (int p = 0; p < near.size(); p++){
+			double s = a.overlap(B.getGaussian(near[p]));
+			if (s < threshold) continue;
+			S.cols.push_back(near[p]);
+			S.vals.push_back(s);
+			S.total += s;
+		}
+		S.rowStart.push_back(S.cols.size());
+	}
+}
+
+// Constructor - index the reference, and find its own total
+OverlapComparer::OverlapComparer(const System& ref_, double threshold_)
+	: ref(ref_), threshold(threshold_), index(ref_, cellSize(cutoffRadius(ref_, threshold_)))
+{
+	long long nonzero;
+	std::vector<int> near;
+	selfRef = screenedTotal(ref, index, ref, cutoffRadius(ref, threshold), threshold, nonzero, near);
+}
+
+// S_AB is found by searching the reference's index around each b_j, and S_BB
+// with an index of B itself
+Similarity OverlapComparer::compare(const System& B) const
+{
+	Similarity sim;
+	sim.N = B.getN();
+	sim.cross = sim.self = sim.tanimoto = 0.0;
+	sim.nonzero = 0;
+	if (sim.N == 0) return sim;
+
+	std::vector<int> near;
+	sim.cross = screenedTotal(ref, index, B, cutoffRadius(ref, B, threshold), threshold,
+							  sim.nonzero, near);
+
+	double radiusB = cutoffRadius(B, threshold);
+	SpatialIndex indexB(B, cellSize(radiusB));
+	long long selfNonzero;
+	sim.self = screenedTotal(B, indexB, B, radiusB, threshold, selfNonzero, near);
+
+	double denominator = selfRef + sim.self - sim.cross;
+	sim.tanimoto = (denominator > 0.0 ? sim.cross/denominator : 0.0);
+	return sim;
+}
+
+// Compare the candidates in batches, on a pool of threads
+void OverlapComparer::compareAll(const std::vector<System>& candidates,
+								 std::vector<Similarity>& results, int nthreads) const
+{
+	int n = candidates.size();
+	results.resize(n);
+	if (n == 0) return;
+	if (nthreads < 1) nthreads = defaultThreads();
+	int batches = (n + COMPARE_BATCH - 1)/COMPARE_BATCH;
+
+	ThreadPool pool(std::min(nthreads, batches));
+	for (int first = 0; first < n; first += COMPARE_BATCH){
+		int last = std::min(n, first + COMPARE_BATCH);
+		pool.submit([this, &candidates, &results, first, last]{
+				for (int k = first; k < last; k++) results[k] = compare(candidates[k]);
+			});
+	}
+	pool.wait();
+}
@@ -0,0 +1,88 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To compare systems by the overlap of their Gaussians, e.g. to screen many
+ *          conformers or poses of a molecule against a reference.
+ *
+ *          The cross-overlap matrix S_AB of systems A and B has elements <a_i|b_j>,
+ *          screened by a threshold as the overlap matrix of a single system is,
+ *          with only the pairs within the cutoff radius calculated. The total of
+ *          its elements, S_AB = sum_ij <a_i|b_j>, measures how alike the two are,
+ *          and the Tanimoto similarity
+ *              S_AB / (S_AA + S_BB - S_AB),
+ *          where S_AA and S_BB are the totals of each self-overlap matrix, is 1 for
+ *          identical systems and 0 for systems that do not overlap at all.
+ *
+ * CONTAINS:
+ *          struct CrossOverlap - the elements of S_AB above the threshold, by rows
+ *          crossOverlap(A, B, threshold, S) - calculate S_AB
+ *          struct Similarity - the totals, and similarity, of a pair of systems
+ *          class OverlapComparer:
+ *              data:
+ *                  ref - the reference system (A)
+ *                  index - spatial index of the reference, built once and shared
+ *                          by every comparison
+ *                  selfRef - S_AA
+ *              routines:
+ *                  compare(B) - the similarity of B to the reference
+ *                  compareAll(candidates, results, nthreads) - compare every
+ *                          candidate, nthreads at a time (on threads of its own,
+ *                          so a caller on a pool should pass its share of it)
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 18/10/26     agent            Original code.
+ * 19/10/26     agent            Thread budget of compareAll documented.
+ *
+ ************************************************************************************/
+
+#ifndef COMPAREHEADERDEF
+#define COMPAREHEADERDEF
+
+#include "spatial.hpp"
+#include <vector>
+
+// Declare forward dependencies
+class System;
+
+// The elements of S_AB at or above the threshold. Row i (a Gaussian of A) has
+// those from rowStart[i] to rowStart[i+1] - 1, with the columns (Gaussians of
+// B) in ascending order.
+struct CrossOverlap
+{
+	std::vector<long long> rowStart;
+	std::vector<int> cols;
+	std::vector<double> vals;
+	double total; // Sum of the elements
+};
+
+// Calculate the screened cross-overlap of A with B
+void crossOverlap(const System& A, const System& B, double threshold, CrossOverlap& S);
+
+struct Similarity
+{
+	int N; // Gaussians in the candidate, or 0 if it has none
+	double cross; // S_AB
+	double self; // S_BB
+	double tanimoto; // S_AB / (S_AA + S_BB - S_AB)
+	long long nonzero; // Elements of S_AB at or above the threshold
+};
+
+class OverlapComparer
+{
+private:
+	const System& ref;
+	double threshold;
+	SpatialIndex index;
+	double selfRef;
+public:
+	OverlapComparer(const System& ref_, double threshold_);
+
+	double getSelfOverlap() const { return selfRef; }
+
+	// Both are safe to call from several threads at once
+	Similarity compare(const System& B) const;
+	void compareAll(const std::vector<System>& candidates, std::vector<Similarity>& results,
+					int nthreads = 0) const;
+};
+
+#endif
@@ -0,0 +1,557 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement the parallel dense symmetric eigensolver
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ * 19/10/26       agent              Sign convention of the eigenvectors.
+ *
+ ***************************************************************************************/
+
+#include "eigensolver.hpp"
+#include "factorise.hpp"
+#include "tasks.hpp"
+#include <Eigen/Eigenvalues>
+#include <Eigen/QR>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cmath>
+
+// Sweeps of the bulge chasing whose reflectors are applied to the eigenvectors
+// together, as block reflectors
+const int CHASE_GROUP = 16;
+
+// Most iterations of the secular equation solver for one root
+const int SECULAR_ITERATIONS = 100;
+
+// Run work(start, end) over [0, n), as one contiguous chunk per thread of the
+// pool, and wait for them all; or as a single chunk if there is no pool
+static void forChunks(ThreadPool* pool, int n, const std::function<void(int, int)>& work)
+{
+	int chunks = (pool ? std::min(n, pool->getNThreads()) : 1);
+	if (chunks <= 1) {
+		if (n > 0) work(0, n);
+		return;
+	}
+	for (int c = 0; c < chunks; c++){
+		int start = (long long) n*c/chunks;
+		int end = (long long) n*(c + 1)/chunks;
+		pool->submit([&work, start, end]{ work(start, end); });
+	}
+	pool->wait();
+}
+
+// The reflectors of one panel of the reduction to band form, acting on
+// rows start onwards as Q = I - V T V^T, with V unit lower trapezoidal
+// and T upper triangular
+struct Panel
+{
+	int start;
+	Eigen::MatrixXd V, T;
+};
+
+// The reflectors H = I - tau v v^T of the bulge chasing, sweep by sweep. Step t of
+// sweep j acts on rows j + 1 + t*b onwards (at most b of them), with v (v(0) = 1)
+// stored in a slot of b entries.
+struct BulgeReflectors
+{
+	int b;
+	std::vector<std::size_t> first; // The first reflector of each sweep, then the total
+	std::vector<double> tau, v;
+
+	void startSweep() { first.push_back(tau.size()); }
+	void add(const Eigen::VectorXd& vec, double t) {
+		tau.push_back(t);
+		v.resize(v.size() + b, 0.0);
+		std::copy(vec.data(), vec.data() + vec.size(), v.end() - b);
+	}
+	int steps(int j) const { return first[j + 1] - first[j]; }
+};
+
+// Reduce the symmetric matrix A (both triangles stored) to a band of half-bandwidth b,
+// a panel of b columns at a time. The part of each panel below the band is QR
+// factorised, leaving R in the band, and the trailing matrix updated as
+//     Q^T A Q = A - V X^T - X V^T,  with X = Y - V (T^T V^T Y)/2 and Y = A V T,
+// by matrix products split among the threads.
+static void reduceToBand(Eigen::MatrixXd& A, int b, ThreadPool* pool, std::vector<Panel>& panels)
+{
+	int n = A.rows();
+	for (int k = 0; k + b + 1 < n; k += b){
+		int r = n - k - b; // Rows below the band
+		int h = std::min(r, b); // Reflectors in the panel
+		Eigen::HouseholderQR<Eigen::MatrixXd> qr(A.block(k + b, k, r, b));
+		const Eigen::MatrixXd& QR = qr.matrixQR();
+
+		Panel p;
+		p.start = k + b;
+		p.V = Eigen::MatrixXd::Zero(r, h);
+		p.T = Eigen::MatrixXd::Zero(h, h);
+		for (int c = 0; c < h; c++){
+			p.V(c, c) = 1.0;
+			p.V.col(c).tail(r - c - 1) = QR.col(c).tail(r - c - 1);
+
+			// Accumulate the triangular factor, as Q = H_0 H_1 ... H_h-1
+			double tau = qr.hCoeffs()(c);
+			p.T(c, c) = tau;
+			if (c > 0) {
+				Eigen::VectorXd t = p.V.leftCols(c).transpose()*p.V.col(c);
+				t = (p.T.topLeftCorner(c, c).triangularView<Eigen::Upper>()*t).eval();
+				p.T.col(c).head(c) = -tau*t;
+			}
+		}
+
+		// The panel becomes R, as does its mirror image
+		Eigen::Block<Eigen::MatrixXd> panel = A.block(k + b, k, r, b);
+		panel = QR;
+		for (int c = 0; c < h; c++) panel.col(c).tail(r - c - 1).setZero();
+		A.block(k, k + b, b, r) = panel.transpose();
+
+		// Y = A V T, then X, by rows of the trailing matrix
+		Eigen::MatrixXd Y(r, h);
+		forChunks(pool, r, [&A, &Y, &p, k, b, r](int start, int end){
+				Y.middleRows(start, end - start).noalias() = A.block(k + b + start, k + b, end - start, r)*p.V;
+			});
+		Y = (Y*p.T.triangularView<Eigen::Upper>()).eval();
+		Eigen::MatrixXd Z = p.T.transpose()*(p.V.transpose()*Y);
+		Y.noalias() -= 0.5*p.V*Z;
+
+		// A - [V X] [X V]^T, by columns of the trailing matrix
+		Eigen::MatrixXd left(r, 2*h), right(r, 2*h);
+		left << p.V, Y;
+		right << Y, p.V;
+		forChunks(pool, r, [&A, &left, &right, k, b, r](int start, int end){
+				A.block(k + b, k + b + start, r, end - start).noalias() -=
+					left*right.middleRows(start, end - start).transpose();
+			});
+
+		panels.push_back(p);
+	}
+}
+
+// Make the Householder reflector H = I - tau v v^T with H x = (beta, 0, ..., 0)^T;
+// x is overwritten by v, with v(0) = 1. Returns tau, which is 0 if x is already
+// of that form (so H = I).
+static double householder(Eigen::Ref<Eigen::VectorXd> x, double& beta)
+{
+	double tau;
+	x.makeHouseholderInPlace(tau, beta);
+	x(0) = 1.0;
+	return tau;
+}
+
+// Apply H = I - tau v v^T to both sides of the symmetric block M (both triangles)
+static void twoSided(Eigen::Ref<Eigen::MatrixXd> M, const Eigen::VectorXd& v, double tau)
+{
+	if (tau == 0.0) return;
+	Eigen::VectorXd p = tau*(M*v);
+	p -= (0.5*tau*p.dot(v))*v;
+	M.noalias() -= v*p.transpose();
+	M.noalias() -= p*v.transpose();
+}
+
+// Reduce the band matrix A (both triangles stored) to tridiagonal form. Each column
+// in turn is reduced below the subdiagonal by a reflector on the next b rows, which
+// fills in a bulge below the band. Only the first column of the bulge is removed, by
+// a reflector on the b rows below, making the next bulge further down, and so on off
+// the end of the matrix; the rest of each bulge is removed by the sweeps of the later
+// columns, so the band never grows beyond 2b.
+static void bandToTridiagonal(Eigen::MatrixXd& A, int b, BulgeReflectors& H)
+{
+	int n = A.rows();
+	H.b = b;
+	double beta;
+	for (int j = 0; j + 2 < n; j++){
+		int s = j + 1, m = std::min(b, n - s);
+		Eigen::VectorXd v = A.col(j).segment(s, m);
+		double tau = householder(v, beta);
+		A.col(j).segment(s, m).setZero();
+		A(s, j) = beta;
+		A.row(j).segment(s, m) = A.col(j).segment(s, m).transpose();
+		twoSided(A.block(s, s, m, m), v, tau);
+		H.startSweep();
+		H.add(v, tau);
+
+		// Chase the bulge off the end
+		while (s + m < n) {
+			int s2 = s + m, m2 = std::min(b, n - s2);
+			Eigen::Block<Eigen::MatrixXd> B = A.block(s2, s, m2, m);
+			if (tau != 0.0) B -= (tau*(B*v))*v.transpose();
+
+			Eigen::VectorXd v2 = B.col(0);
+			double tau2 = householder(v2, beta);
+			if (tau2 != 0.0)
+				B.rightCols(m - 1) -= (tau2*v2)*(v2.transpose()*B.rightCols(m - 1));
+			B.col(0).setZero();
+			B(0, 0) = beta;
+			A.block(s, s2, m, m2) = B.transpose();
+			twoSided(A.block(s2, s2, m2, m2), v2, tau2);
+			H.add(v2, tau2);
+
+			s = s2; m = m2;
+			v.swap(v2);
+			tau = tau2;
+		}
+	}
+	H.startSweep();
+}
+
+// Make the reflectors of step t of sweeps j0 to j1 - 1 into the block reflector
+// H_j0 H_j0+1 ... H_j1-1 = I - V T V^T. Their rows are each shifted one down from the
+// last, so V is a band of width b. Returns false if none of the sweeps got that far.
+static bool chaseBlock(const BulgeReflectors& H, int n, int j0, int j1, int t, Panel& p)
+{
+	int b = H.b;
+	if (H.steps(j0) <= t) return false;
+	p.start = j0 + 1 + t*b;
+	int rows = std::min(n, j1 + t*b + b) - p.start, cols = j1 - j0;
+	p.V.setZero(rows, cols);
+	p.T.setZero(cols, cols);
+	for (int c = 0; c < cols && H.steps(j0 + c) > t; c++){
+		std::size_t r = H.first[j0 + c] + t;
+		int length = std::min(b, n - (p.start + c));
+		p.V.col(c).segment(c, length) = Eigen::Map<const Eigen::VectorXd>(&H.v[r*b], length);
+
+		double tau = H.tau[r];
+		p.T(c, c) = tau;
+		if (c > 0) {
+			Eigen::VectorXd w = p.V.leftCols(c).transpose()*p.V.col(c);
+			w = (p.T.topLeftCorner(c, c).triangularView<Eigen::Upper>()*w).eval();
+			p.T.col(c).head(c) = -tau*w;
+		}
+	}
+	return true;
+}
+
+// Apply the block reflector I - V T V^T of p to columns first to last - 1 of X
+static void applyBlock(const Panel& p, Eigen::MatrixXd& X, int first, int last)
+{
+	Eigen::Block<Eigen::MatrixXd> Xp = X.block(p.start, first, p.V.rows(), last - first);
+	Eigen::MatrixXd W = p.T.triangularView<Eigen::Upper>()*(p.V.transpose()*Xp);
+	Xp.noalias() -= p.V*W;
+}
+
+// Solve the subproblem of rows s to t directly, with its end diagonal entries reduced
+// by the couplings |e| to its neighbours, so that they can be merged back in as rank-one
+// modifications
+static void solveLeaf(const Eigen::VectorXd& d, const Eigen::VectorXd& e, int s, int t,
+					  Eigen::VectorXd& lambda, Eigen::MatrixXd& Z)
+{
+	int k = t - s, n = d.size();
+	Eigen::MatrixXd T = Eigen::MatrixXd::Zero(k, k);
+	T.diagonal() = d.segment(s, k);
+	if (k > 1) {
+		T.diagonal(-1) = e.segment(s, k - 1);
+		T.diagonal(1) = e.segment(s, k - 1);
+	}
+	if (s > 0) T(0, 0) -= std::abs(e(s - 1));
+	if (t < n) T(k - 1, k - 1) -= std::abs(e(t - 1));
+
+	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(T);
+	lambda.segment(s, k) = solver.eigenvalues();
+	Z.block(s, s, k, k) = solver.eigenvectors();
+}
+
+// Root i of the secular equation
+//     w(lambda) = 1/rho + sum_j z_j^2/(d_j - lambda) = 0,
+// with the d_j ascending, which lies between d_i and d_i+1 (or above the last).
+// It is returned as the pole d_origin it is nearest, and the offset mu from it, so
+// that every difference d_j - lambda = (d_j - d_origin) - mu is found accurately.
+// Each step solves a model of w with the same value and slope, with the two nearest
+// poles, falling back to bisection if that leaves the interval known to hold the root.
+static void secularRoot(const Eigen::VectorXd& d, const Eigen::VectorXd& z, double rho, int i,
+						int& origin, double& mu)
+{
+	int K = d.size();
+	const double eps = std::numeric_limits<double>::epsilon();
+	bool last = (i == K - 1);
+
+	// Which half of the interval is the root in?
+	double lo, hi;
+	if (!last) {
+		double gap = d(i + 1) - d(i);
+		double w = 1.0/rho;
+		for (int j = 0; j < K; j++) w += z(j)*z(j)/((d(j) - d(i)) - 0.5*gap);
+		if (w >= 0.0) { origin = i; lo = 0.0; hi = 0.5*gap; }
+		else { origin = i + 1; lo = -0.5*gap; hi = 0.0; }
+	} else {
+		origin = i;
+		lo = 0.0;
+		hi = rho*z.squaredNorm();
+	}
+	double below = d(i) - d(origin); // The poles either side, relative to the origin
+	double above = (last ? 0.0 : d(i + 1) - d(origin));
+
+	mu = 0.5*(lo + hi);
+	for (int iter = 0; iter < SECULAR_ITERATIONS; iter++){
+		// Terms with poles at or below d_i, and above it
+		double psi = 0.0, dpsi = 0.0, phi = 0.0, dphi = 0.0;
+		for (int j = 0; j <= i; j++){
+			double t = z(j)/((d(j) - d(origin)) - mu);
+			psi += z(j)*t;
+			dpsi += t*t;
+		}
+		for (int j = i + 1; j < K; j++){
+			double t = z(j)/((d(j) - d(origin)) - mu);
+			phi += z(j)*t;
+			dphi += t*t;
+		}
+		double w = 1.0/rho + psi + phi;
+
+		// w increases with mu
+		if (w < 0.0) lo = mu;
+		else hi = mu;
+		double error = 8.0*eps*(1.0/rho + phi - psi) + eps*std::abs(mu)*(dpsi + dphi);
+		if (std::abs(w) <= error || hi - lo <= 2.0*eps*std::max(std::abs(lo), std::abs(hi))) break;
+
+		// Model psi by a + b1/(below - x), phi by a + b2/(above - x), then find its
+		// root as mu + step
+		double dBelow = below - mu, dAbove = above - mu;
+		double b1 = dpsi*dBelow*dBelow;
+		double step;
+		if (!last) {
+			double b2 = dphi*dAbove*dAbove;
+			double c = w - b1/dBelow - b2/dAbove;
+			double qa = c, qb = -(c*(dBelow + dAbove) + b1 + b2), qc = dBelow*dAbove*w;
+			double disc = qb*qb - 4.0*qa*qc;
+			step = std::numeric_limits<double>::quiet_NaN();
+			if (disc >= 0.0) {
+				double q = -0.5*(qb + std::copysign(std::sqrt(disc), qb));
+				double r1 = (qa != 0.0 ? q/qa : std::numeric_limits<double>::quiet_NaN());
+				double r2 = (q != 0.0 ? qc/q : std::numeric_limits<double>::quiet_NaN());
+				if (mu + r2 > lo && mu + r2 < hi) step = r2;
+				else if (mu + r1 > lo && mu + r1 < hi) step = r1;
+			}
+		} else {
+			double c = w - b1/dBelow;
+			step = (c > 0.0 ? dBelow + b1/c : std::numeric_limits<double>::quiet_NaN());
+		}
+
+		double next = mu + step;
+		if (!(next > lo && next < hi)) next = 0.5*(lo + hi);
+		mu = next;
+	}
+}
+
+// Merge the solved subproblems of rows s to m, and m to t, which are coupled by
+// beta = e(m-1). In terms of their eigenvectors Q, the merged matrix is
+//     Q (D + rho z z^T) Q^T,
+// with rho = 2|beta| and z made from the last row of the first and the first row of the
+// second. Eigenvalues whose z is negligible, or which are too close to another, are
+// deflated (as in LAPACK's dlaed2); the rest are the roots of the secular equation, and
+// their eigenvectors are Q times those of D + rho z z^T, built from a z recomputed from
+// the roots (Gu and Eisenstat) so that they are orthogonal to working precision.
+static void merge(const Eigen::VectorXd& e, int s, int m, int t, Eigen::VectorXd& lambda,
+				  Eigen::MatrixXd& Z, ThreadPool* pool)
+{
+	int k = t - s;
+	const double eps = std::numeric_limits<double>::epsilon();
+	double beta = e(m - 1);
+	double rho = 2.0*std::abs(beta);
+	double sign = (beta < 0.0 ? -1.0 : 1.0);
+
+	// Sort the eigenvalues of the two halves together
+	std::vector<int> order(k);
+	std::iota(order.begin(), order.end(), 0);
+	std::stable_sort(order.begin(), order.end(), [&lambda, s](int a, int b){
+			return lambda(s + a) < lambda(s + b);
+		});
+	Eigen::VectorXd dl(k), z(k);
+	Eigen::MatrixXd Q(k, k);
+	for (int i = 0; i < k; i++){
+		int j = s + order[i];
+		dl(i) = lambda(j);
+		z(i) = (j < m ? Z(m - 1, j) : sign*Z(m, j))/std::sqrt(2.0);
+		Q.col(i) = Z.block(s, j, k, 1);
+	}
+
+	// Deflate
+	double tol = 8.0*eps*std::max(dl.cwiseAbs().maxCoeff(), z.cwiseAbs().maxCoeff());
+	std::vector<int> kept;
+	int pj = -1;
+	for (int j = 0; j < k; j++){
+		if (rho*std::abs(z(j)) <= tol) continue;
+		if (pj >= 0) {
+			// Rotate away z(pj), if that barely changes the eigenvalues
+			double c = z(j), sn = z(pj);
+			double r = std::hypot(c, sn);
+			double gap = dl(j) - dl(pj);
+			c /= r; sn = -sn/r;
+			if (std::abs(gap*c*sn) <= tol) {
+				z(j) = r;
+				z(pj) = 0.0;
+				for (int row = 0; row < k; row++){
+					double x = Q(row, pj), y = Q(row, j);
+					Q(row, pj) = c*x + sn*y;
+					Q(row, j) = c*y - sn*x;
+				}
+				double dp = dl(pj)*c*c + dl(j)*sn*sn;
+				dl(j) = dl(pj)*sn*sn + dl(j)*c*c;
+				dl(pj) = dp;
+			} else kept.push_back(pj);
+		}
+		pj = j;
+	}
+	if (pj >= 0) kept.push_back(pj);
+
+	// Solve the secular equation for the eigenvalues that remain
+	int K = kept.size();
+	Eigen::VectorXd dK(K), zK(K), muK(K);
+	std::vector<int> origin(K);
+	for (int i = 0; i < K; i++){
+		dK(i) = dl(kept[i]);
+		zK(i) = z(kept[i]);
+	}
+	forChunks(pool, K, [&](int first, int last){
+			for (int i = first; i < last; i++) secularRoot(dK, zK, rho, i, origin[i], muK(i));
+		});
+
+	// Recompute z, then the eigenvectors of D + rho z z^T
+	Eigen::VectorXd zHat(K);
+	forChunks(pool, K, [&](int first, int last){
+			for (int i = first; i < last; i++){
+				double p = ((dK(origin[i]) - dK(i)) + muK(i))/rho;
+				for (int j = 0; j < K; j++)
+					if (j != i) p *= ((dK(origin[j]) - dK(i)) + muK(j))/(dK(j) - dK(i));
+				zHat(i) = std::copysign(std::sqrt(std::max(p, 0.0)), zK(i));
+			}
+		});
+	Eigen::MatrixXd U(K, K);
+	forChunks(pool, K, [&](int first, int last){
+			for (int i = first; i < last; i++){
+				for (int j = 0; j < K; j++)
+					U(j, i) = zHat(j)/((dK(j) - dK(origin[i])) - muK(i));
+				U.col(i).normalize();
+			}
+		});
+
+	Eigen::MatrixXd QK(k, K);
+	for (int i = 0; i < K; i++) QK.col(i) = Q.col(kept[i]);
+	Eigen::MatrixXd merged(k, K);
+	forChunks(pool, K, [&](int first, int last){
+			merged.middleCols(first, last - first).noalias() = QK*U.middleCols(first, last - first);
+		});
+
+	// Gather the new eigenvalues and the deflated ones, in ascending order
+	std::vector<bool> isKept(k, false);
+	for (int i = 0; i < K; i++) isKept[kept[i]] = true;
+	std::vector<std::pair<double, int> > all; // Eigenvalue, and column (merged first)
+	for (int i = 0; i < K; i++) all.push_back(std::make_pair(dK(origin[i]) + muK(i), i));
+	for (int j = 0; j < k; j++)
+		if (!isKept[j]) all.push_back(std::make_pair(dl(j), K + j));
+	std::stable_sort(all.begin(), all.end(),
+					 [](const std::pair<double, int>& a, const std::pair<double, int>& b){
+						 return a.first < b.first;
+					 });
+	for (int i = 0; i < k; i++){
+		lambda(s + i) = all[i].first;
+		int c = all[i].second;
+		if (c < K) Z.block(s, s + i, k, 1) = merged.col(c);
+		else Z.block(s, s + i, k, 1) = Q.col(c - K);
+	}
+}
+
+// Eigenvalues (ascending) and eigenvectors of the tridiagonal matrix with diagonal d
+// and subdiagonal e, by divide and conquer. The leaves are solved directly, then
+// merged in pairs, a level at a time; while there are at least as many merges in a
+// level as threads they run concurrently, otherwise each is split among the threads.
+static void tridiagonalEigen(const Eigen::VectorXd& d, const Eigen::VectorXd& e,
+							 Eigen::VectorXd& lambda, Eigen::MatrixXd& Z, ThreadPool* pool)
+{
+	int n = d.size();
+	lambda.resize(n);
+	Z.setZero(n, n);
+
+	std::vector<int> bounds; // Where each subproblem starts, and n
+	for (int s = 0; s < n; s += EIGEN_LEAF) bounds.push_back(s);
+	bounds.push_back(n);
+
+	forChunks(pool, bounds.size() - 1, [&](int first, int last){
+			for (int l = first; l < last; l++) solveLeaf(d, e, bounds[l], bounds[l + 1], lambda, Z);
+		});
+
+	while (bounds.size() > 2) {
+		int pairs = (bounds.size() - 1)/2;
+		if (pool && pairs >= pool->getNThreads()) {
+			forChunks(pool, pairs, [&](int first, int last){
+					for (int p = first; p < last; p++)
+						merge(e, bounds[2*p], bounds[2*p + 1], bounds[2*p + 2], lambda, Z, nullptr);
+				});
+		} else {
+			for (int p = 0; p < pairs; p++)
+				merge(e, bounds[2*p], bounds[2*p + 1], bounds[2*p + 2], lambda, Z, pool);
+		}
+
+		// An odd subproblem out is merged at the next level
+		std::vector<int> next;
+		for (std::size_t b = 0; b < bounds.size(); b += 2) next.push_back(bounds[b]);
+		if (next.back() != n) next.push_back(n);
+		bounds.swap(next);
+	}
+}
+
+// Eigendecomposition of A, by the two-stage reduction, divide and conquer,
+// then the back transformation of the eigenvectors
+void parallelEigen(const Eigen::Ref<const Eigen::MatrixXd>& A, EigenPairs& eig, int nthreads)
+{
+	int n = A.rows();
+	if (n < EIGEN_MIN_PARALLEL) {
+		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(A);
+		eig.values = solver.eigenvalues();
+		eig.vectors = solver.eigenvectors();
+		fixSigns(eig);
+		return;
+	}
+
+	if (nthreads < 1) nthreads = defaultThreads();
+	std::unique_ptr<ThreadPool> threads;
+	if (nthreads > 1) threads.reset(new ThreadPool(nthreads));
+	ThreadPool* pool = threads.get();
+
+	// Reduce to tridiagonal form, in two stages
+	Eigen::MatrixXd B = A.selfadjointView<Eigen::Lower>();
+	std::vector<Panel> panels;
+	reduceToBand(B, EIGEN_BAND, pool, panels);
+	BulgeReflectors chase;
+	bandToTridiagonal(B, EIGEN_BAND, chase);
+	Eigen::VectorXd d = B.diagonal(), e = B.diagonal(-1);
+	B.resize(0, 0);
+
+	tridiagonalEigen(d, e, eig.values, eig.vectors, pool);
+
+	// Transform the eigenvectors back through both stages, in reverse order. Within a
+	// group of sweeps, a reflector only overlaps those of the later sweeps at the step
+	// before it, so the group is the product of its blocks in decreasing order of step.
+	Eigen::MatrixXd& X = eig.vectors;
+	int sweeps = chase.first.size() - 1;
+	int groups = (sweeps + CHASE_GROUP - 1)/CHASE_GROUP;
+	forChunks(pool, n, [&](int first, int last){
+			Panel block;
+			for (int g = groups - 1; g >= 0; g--){
+				int j0 = g*CHASE_GROUP, j1 = std::min(sweeps, j0 + CHASE_GROUP);
+				for (int t = 0; chaseBlock(chase, n, j0, j1, t, block); t++)
+					applyBlock(block, X, first, last);
+			}
+
+			for (int p = panels.size() - 1; p >= 0; p--) applyBlock(panels[p], X, first, last);
+		});
+	fixSigns(eig);
+}
+
+// The first component of each eigenvector within EIGEN_SIGN_TOLERANCE of its
+// largest is made positive, so that components equal by symmetry, which
+// rounding may order either way, do not make the choice depend on the solver
+void fixSigns(EigenPairs& eig)
+{
+	Eigen::MatrixXd& X = eig.vectors;
+	for (int j = 0; j < X.cols(); j++){
+		double largest = X.col(j).cwiseAbs().maxCoeff();
+		int k = 0;
+		while (k < X.rows() && std::abs(X(k, j)) < (1.0 - EIGEN_SIGN_TOLERANCE)*largest) k++;
+		if (k < X.rows() && X(k, j) < 0.0) X.col(j) = -X.col(j);
+	}
+}
@@ -0,0 +1,187 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement the sampling estimate of the overlap matrix sparsity
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ *
+ ***************************************************************************************/
+
+#include "estimate.hpp"
+#include "spatial.hpp"
+#include "system.hpp"
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <cmath>
+
+// Strata: same cell, and neighbouring cells sharing a face, edge, or corner
+const int NSTRATA = 4;
+
+// The 13 neighbouring cell offsets that come after (0, 0, 0), so that
+// each pair of neighbouring cells is visited exactly once
+static void forwardOffsets(std::vector<int>& dx, std::vector<int>& dy, std::vector<int>& dz)
+{
+	for (int i = -1; i <= 1; i++)
+		for (int j = -1; j <= 1; j++)
+			for (int k = -1; k <= 1; k++)
+				if (i > 0 || (i == 0 && (j > 0 || (j == 0 && k > 0)))) {
+					dx.push_back(i); dy.push_back(j); dz.push_back(k);
+				}
+}
+
+// Two-sided normal quantile for a confidence level, by bisection on erfc
+static double normalQuantile(double confidence)
+{
+	double lo = 0.0, hi = 10.0;
+	for (int it = 0; it < 100; it++){
+		double mid = 0.5*(lo + hi);
+		if (erfc(mid/sqrt(2.0)) > 1.0 - confidence) lo = mid; else hi = mid;
+	}
+	return 0.5*(lo + hi);
+}
+
+// Estimate the sparsity by stratified sampling of the near pairs
+SparsityEstimate estimateSparsity(const System& sys, int samples, double confidence)
+{
+	int N = sys.getN();
+	double threshold = sys.getThreshold();
+
+	SparsityEstimate est;
+	est.samples = 0;
+	est.confidence = confidence;
+	est.total = ((long long) N*(N+1))/2;
+	est.nearPairs = 0;
+	est.nonzero = 0.0;
+	est.nonzeroError = 0.0;
+	est.exact = true;
+
+	// The diagonal is cheap, so is done exactly
+	for (int i = 0; i < N; i++){
+		const Gaussian& g = sys.getGaussian(i);
+		if (g.overlap(g) >= threshold) est.nonzero += 1.0;
+	}
+
+	est.cutoff = cutoffRadius(sys, threshold);
+	SpatialIndex index(sys, est.cutoff);
+	est.cells = index.getNCells();
+	const std::vector<int>& order = index.getOrder();
+	if (est.cutoff == 0.0) return est; // No pair off the diagonal can be non-zero
+
+	std::vector<int> dx, dy, dz;
+	forwardOffsets(dx, dy, dz);
+	std::vector<int> stratumOf(dx.size());
+	for (int o = 0; o < dx.size(); o++)
+		stratumOf[o] = std::abs(dx[o]) + std::abs(dy[o]) + std::abs(dz[o]);
+
+	// Find the neighbours of each cell, and the cumulative number
+	// of pairs in each stratum up to and including each cell
+	int C = index.getNCells();
+	std::vector<int> neighbours(C*dx.size());
+	std::vector<std::vector<double> > cumulative(NSTRATA, std::vector<double>(C));
+	double size[NSTRATA] = { 0.0, 0.0, 0.0, 0.0 };
+	int cx, cy, cz;
+	for (int c = 0; c < C; c++){
+		double nc = index.cellEnd(c) - index.cellBegin(c);
+		size[0] += 0.5*nc*(nc - 1.0);
+
+		index.cellCoords(c, cx, cy, cz);
+		for (int o = 0; o < dx.size(); o++){
+			int d = index.findCell(cx + dx[o], cy + dy[o], cz + dz[o]);
+			neighbours[c*dx.size() + o] = d;
+			if (d >= 0) size[stratumOf[o]] += nc*(index.cellEnd(d) - index.cellBegin(d));
+		}
+
+		for (int h = 0; h < NSTRATA; h++) cumulative[h][c] = size[h];
+	}
+	double near = 0.0;
+	for (int h = 0; h < NSTRATA; h++) near += size[h];
+	est.nearPairs = (long long) near;
+
+	std::mt19937_64 generator(12345);
+	std::uniform_real_distribution<double> uniform(0.0, 1.0);
+	double z = normalQuantile(confidence);
+	double variance = 0.0;
+
+	for (int h = 0; h < NSTRATA; h++){
+		if (size[h] == 0.0) continue;
+
+		// Proportional allocation, with at least a few samples per stratum
+		long long nh = std::max(100LL, (long long) round(samples*size[h]/near));
+		long long hits = 0;
+
+		if (nh >= size[h]) {
+			// Small enough to evaluate every pair in the stratum
+			for (int c = 0; c < C; c++){
+				for (int p = index.cellBegin(c); p < index.cellEnd(c); p++){
+					const Gaussian& gi = sys.getGaussian(order[p]);
+					if (h == 0) {
+						for (int q = index.cellBegin(c); q < p; q++)
+							if (gi.overlap(sys.getGaussian(order[q])) >= threshold) hits++;
+					} else {
+						for (int o = 0; o < dx.size(); o++){
+							int d = neighbours[c*dx.size() + o];
+							if (d < 0 || stratumOf[o] != h) continue;
+							for (int q = index.cellBegin(d); q < index.cellEnd(d); q++)
+								if (gi.overlap(sys.getGaussian(order[q])) >= threshold) hits++;
+						}
+					}
+				}
+			}
+			est.samples += (int) size[h];
+			est.nonzero += hits;
+			continue;
+		}
+
+		// Otherwise sample pairs uniformly from the stratum: choose a cell (and
+		// neighbour) with probability proportional to the pairs it holds, then
+		// a pair within it
+		est.exact = false;
+		for (long long s = 0; s < nh; s++){
+			double u = uniform(generator)*size[h];
+			int c = std::upper_bound(cumulative[h].begin(), cumulative[h].end(), u) - cumulative[h].begin();
+			if (c >= C) c = C - 1;
+			u -= (c > 0 ? cumulative[h][c-1] : 0.0);
+
+			int begin = index.cellBegin(c);
+			int nc = index.cellEnd(c) - begin;
+			int i, j;
+			if (h == 0) {
+				i = std::min(nc - 1, (int) (uniform(generator)*nc));
+				j = std::min(nc - 2, (int) (uniform(generator)*(nc - 1)));
+				if (j >= i) j++;
+				i = order[begin + i]; j = order[begin + j];
+			} else {
+				// Find which neighbour u falls in, then the pair within
+				int d = -1;
+				for (int o = 0; o < dx.size(); o++){
+					int e = neighbours[c*dx.size() + o];
+					if (e < 0 || stratumOf[o] != h) continue;
+					d = e;
+					double pairs = (double) nc*(index.cellEnd(e) - index.cellBegin(e));
+					if (u < pairs) break;
+					u -= pairs;
+				}
+				int nd = index.cellEnd(d) - index.cellBegin(d);
+				long long pair = std::min((long long) u, (long long) nc*nd - 1);
+				i = order[begin + pair/nd];
+				j = order[index.cellBegin(d) + pair%nd];
+			}
+
+			if (sys.getGaussian(i).overlap(sys.getGaussian(j)) >= threshold) hits++;
+		}
+		est.samples += nh;
+
+		// Scale up the hit rate, with an Agresti-Coull adjusted variance so that
+		// strata with no (or all) hits still contribute some uncertainty, and a
+		// finite population correction
+		double p = (double) hits/nh;
+		double padj = (hits + 2.0)/(nh + 4.0);
+		est.nonzero += size[h]*p;
+		variance += size[h]*size[h]*padj*(1.0 - padj)/(nh + 4.0)*(1.0 - nh/size[h]);
+	}
+
+	est.nonzeroError = z*sqrt(variance);
+	return est;
+}
@@ -0,0 +1,51 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To estimate the sparsity of the overlap matrix of a System by sampling,
+ *          so that the cost (in time and memory) of a full calcOverlap can be judged
+ *          before it is attempted.
+ *
+ *          Space is divided into cells with sides of the cutoff radius, beyond which
+ *          no integral can reach the threshold, so every pair of Gaussians that are
+ *          not in the same or neighbouring cells is known to be zero without being
+ *          evaluated. The remaining pairs are split into strata - same cell, and cells
+ *          sharing a face, an edge, or a corner - which are sampled in proportion to
+ *          their size, any stratum smaller than its share of the samples being
+ *          evaluated exhaustively. The diagonal is always evaluated exactly.
+ *
+ * CONTAINS:
+ *          struct SparsityEstimate - the results, with nonzeroError the half-width of
+ *                                    the confidence interval on nonzero
+ *          estimateSparsity(sys, samples, confidence) - estimate the number of
+ *                               integrals at or above the System's threshold
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 18/10/26     agent            Original code.
+ *
+ ************************************************************************************/
+
+#ifndef ESTIMATEHEADERDEF
+#define ESTIMATEHEADERDEF
+
+// Declare forward dependencies
+class System;
+
+struct SparsityEstimate
+{
+	int samples; // Number of pairs evaluated (off the diagonal)
+	double confidence; // Confidence level of the interval, e.g. 0.95
+	double cutoff; // Cutoff radius, and so cell size
+	int cells; // Number of occupied cells
+	long long total; // Number of possible unique integrals
+	long long nearPairs; // Off-diagonal pairs in the same or neighbouring cells
+	double nonzero; // Estimated number of non-zero integrals
+	double nonzeroError; // Half-width of the confidence interval on nonzero
+	bool exact; // True if every near pair was evaluated
+
+	double zeroes() const { return total - nonzero; }
+	double sparsity() const { return 100.0*zeroes()/total; }
+};
+
+SparsityEstimate estimateSparsity(const System& sys, int samples, double confidence = 0.95);
+
+#endif
@@ -0,0 +1,164 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement class FactorCache
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ * 18/10/26       agent              Rows read through a RowReader.
+ * 18/10/26       agent              Lazy rows.
+ * 18/10/26       agent              Choice of eigensolver.
+ * 19/10/26       agent              Leading part of a cache.
+ * 19/10/26       agent              Thread budget of the parallel eigensolver.
+ * 19/10/26       agent              Columns read through RowReader::col.
+ * 19/10/26       agent              Eigenvectors follow the sign convention of fixSigns.
+ *
+ ***************************************************************************************/
+
+#include "factorise.hpp"
+#include "system.hpp"
+#include "storage.hpp"
+#include <Eigen/Eigenvalues>
+#include <iostream>
+#include <algorithm>
+
+// Constructor - nothing is cached to begin with
+FactorCache::FactorCache() : nS(0), nL(0)
+{
+}
+
+// Grow the cached overlap matrix to the leading n x n block, reading on
+// from the row where the last block finished. As the integrals are stored
+// row by row, the leading block of n functions is exactly the first n rows.
+void FactorCache::growOverlap(const System& sys, int n)
+{
+	if (n <= nS) return;
+
+	std::shared_ptr<Eigen::MatrixXd> grown = std::make_shared<Eigen::MatrixXd>(n, n);
+	Eigen::MatrixXd& newS = *grown;
+	if (nS > 0) newS.topLeftCorner(nS, nS) = S->topLeftCorner(nS, nS);
+	newS.bottomRows(n - nS).setZero();
+	newS.rightCols(n - nS).setZero();
+
+	// If all the non-diagonal overlap integrals are zero (it could happen!)
+	// then S should just be the identity matrix
+	if ( sys.hasOverlap() && sys.getNonZero() == sys.getN() ) {
+
+		for (int i = nS; i < n; i++) newS(i, i) = 1.0;
+
+	} else {
+
+		// Put the non-zero integrals of each new row into the overlap matrix
+		RowReader reader(sys);
+		for (int i = nS; i < n; i++){
+			int count = reader.read(i);
+			for (int k = 0; k < count; k++){
+				int j = reader.col(k);
+				newS(j, i) = reader.vals[k];
+				newS(i, j) = newS(j, i); // Overlap matrix is symmetric
+			}
+		}
+	}
+
+	S = grown;
+	nS = n;
+}
+
+// Return the overlap matrix, with at least the leading n x n block filled
+std::shared_ptr<const Eigen::MatrixXd> FactorCache::overlap(const System& sys, int n)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	growOverlap(sys, n);
+	return S;
+}
+
+// Return the Cholesky factor of the leading n x n block. The leading block
+// of a Cholesky factor is the factor of the leading block, so smaller requests
+// are served from the cached factor, and larger ones extend it with new rows:
+//      [ L11  0   ] [ L11^T L21^T ]   [ S11 S12 ]
+//      [ L21  L22 ] [ 0     L22^T ] = [ S21 S22 ]
+// gives L21 = S21 L11^-T, and L22 as the Cholesky factor of S22 - L21 L21^T.
+std::shared_ptr<const Eigen::MatrixXd> FactorCache::cholesky(const System& sys, int n)
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (n > nL) {
+		growOverlap(sys, n);
+		int m = n - nL;
+
+		std::shared_ptr<Eigen::MatrixXd> grown = std::make_shared<Eigen::MatrixXd>(n, n);
+		Eigen::MatrixXd& newL = *grown;
+		newL.rightCols(m).setZero();
+
+		if (nL > 0) {
+			newL.topLeftCorner(nL, nL) = L->topLeftCorner(nL, nL);
+
+			// New off-diagonal rows, by triangular solve against the old factor
+			newL.block(nL, 0, m, nL) = L->topLeftCorner(nL, nL).triangularView<Eigen::Lower>()
+				.solve(S->block(0, nL, nL, m)).transpose();
+		}
+
+		// New diagonal block, from the Schur complement, formed and
+		// factorised in place in the lower triangle of the new factor
+		newL.block(nL, nL, m, m).triangularView<Eigen::Lower>() = S->block(nL, nL, m, m);
+		if (nL > 0)
+			newL.block(nL, nL, m, m).selfadjointView<Eigen::Lower>()
+				.rankUpdate(newL.block(nL, 0, m, nL), -1.0);
+		Eigen::Ref<Eigen::MatrixXd> L22 = newL.block(nL, nL, m, m);
+		Eigen::LLT<Eigen::Ref<Eigen::MatrixXd> > lltOfSchur(L22);
+		if (lltOfSchur.info() != Eigen::Success)
+			std::cerr << "Cholesky decomposition failed - overlap matrix "
+					  << "is not positive definite.\n";
+		L22.triangularView<Eigen::StrictlyUpper>().setZero();
+
+		L = grown;
+		nL = n;
+	}
+
+	return L;
+}
+
+// Return the eigendecomposition of the leading n x n block, computing
+// it only if no other command has already done so with the same solver
+std::shared_ptr<const EigenPairs> FactorCache::eigen(const System& sys, int n, int solver, int nthreads)
+{
+	std::shared_ptr<EigenEntry> entry;
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		std::shared_ptr<EigenEntry>& e = eigenEntries[std::make_pair(n, solver)];
+		if (!e) e = std::make_shared<EigenEntry>();
+		entry = e;
+	}
+
+	// Only the first caller solves; any others wait here for it
+	std::call_once(entry->once, [this, &sys, n, solver, nthreads, &entry]{
+			std::shared_ptr<const Eigen::MatrixXd> block = overlap(sys, n);
+			if (solver == PARALLEL_EIGEN) {
+				parallelEigen(block->topLeftCorner(n, n), entry->pairs, nthreads);
+				return;
+			}
+			Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> es(block->topLeftCorner(n, n));
+			entry->pairs.values = es.eigenvalues();
+			entry->pairs.vectors = es.eigenvectors();
+			fixSigns(entry->pairs);
+		});
+
+	return std::shared_ptr<const EigenPairs>(entry, &entry->pairs);
+}
+
+// The leading n x n blocks of S and L are those of the first n functions, so
+// are kept (growOverlap and cholesky only read the leading nS and nL of them),
+// as are the eigendecompositions of blocks of at most n
+std::shared_ptr<FactorCache> FactorCache::leading(int n)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	std::shared_ptr<FactorCache> cache = std::make_shared<FactorCache>();
+	cache->S = S;
+	cache->nS = std::min(nS, n);
+	cache->L = L;
+	cache->nL = std::min(nL, n);
+	for (std::map<std::pair<int, int>, std::shared_ptr<EigenEntry> >::const_iterator e = eigenEntries.begin();
+		 e != eigenEntries.end(); ++e)
+		if (e->first.first <= n) cache->eigenEntries.insert(*e);
+	return cache;
+}
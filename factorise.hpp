@@ -0,0 +1,97 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To cache the dense overlap matrix of the leading basis functions of a
+ *          System, and its factorisations, so that they are formed once and shared
+ *          between all the orthogonalisation commands that need them.
+ *
+ * CONTAINS:
+ *          class FactorCache:
+ *              data:
+ *                  S - the dense overlap matrix of the first nS functions, grown
+ *                      as larger blocks are requested
+ *                  L - the Cholesky factor of the first nL functions, extended
+ *                      row-wise when a larger block is requested
+ *                  eigen - eigendecompositions, keyed by block size and solver
+ *              routines:
+ *                  overlap(sys, n) - the overlap matrix, at least n x n
+ *                  cholesky(sys, n) - the lower-triangular L with S = LL^T, whose
+ *                                     n x n leading block is the factor of the
+ *                                     n x n leading block of S
+ *                  eigen(sys, n, solver, nthreads) - the eigenvalues and eigenvectors
+ *                                          of the n x n leading block, by Eigen's solver
+ *                                          or the parallel one (see eigensolver.hpp),
+ *                                          on at most nthreads threads
+ *                  leading(n) - a new cache of only what is held for the first n
+ *                               functions, for a System whose later functions
+ *                               have changed
+ *
+ *          All routines are thread safe; if two threads ask for the same
+ *          eigendecomposition, one computes it while the other waits.
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 18/10/26     agent            Original code.
+ * 18/10/26     agent            Rows read through a RowReader.
+ * 18/10/26     agent            Choice of eigensolver.
+ * 19/10/26     agent            Leading part of a cache.
+ * 19/10/26     agent            Thread budget of the parallel eigensolver.
+ *
+ ************************************************************************************/
+
+#ifndef FACTORISEHEADERDEF
+#define FACTORISEHEADERDEF
+
+#include "eigensolver.hpp"
+#include <Eigen/Dense>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+// Declare forward dependencies
+class System;
+
+// Eigenvalues (in ascending order) and the corresponding eigenvectors
+struct EigenPairs
+{
+	Eigen::VectorXd values;
+	Eigen::MatrixXd vectors;
+};
+
+class FactorCache
+{
+private:
+	// A single eigendecomposition, computed at most once
+	struct EigenEntry {
+		std::once_flag once;
+		EigenPairs pairs;
+	};
+
+	// S and L are replaced, rather than resized, when they grow, so
+	// that callers can keep using the block they were given
+	std::mutex lock; // Guards S, L, and the eigen map
+	std::shared_ptr<Eigen::MatrixXd> S; // Leading block of the overlap matrix
+	int nS; // Size of S
+	std::shared_ptr<Eigen::MatrixXd> L; // Cholesky factor of the leading nL x nL block
+	int nL;
+	std::map<std::pair<int, int>, std::shared_ptr<EigenEntry> > eigenEntries; // By n and solver
+
+	void growOverlap(const System& sys, int n); // Extend S to n x n, lock must be held
+public:
+	FactorCache();
+
+	// The matrices returned may be larger than n x n, in which case
+	// the leading n x n block is the one asked for
+	std::shared_ptr<const Eigen::MatrixXd> overlap(const System& sys, int n);
+	std::shared_ptr<const Eigen::MatrixXd> cholesky(const System& sys, int n);
+	// nthreads is the budget of the parallel solver, which, called from a task on a
+	// pool, should be that task's share of the pool rather than one thread per core
+	std::shared_ptr<const EigenPairs> eigen(const System& sys, int n, int solver = SERIAL_EIGEN,
+											int nthreads = 0);
+
+	// The matrices and eigendecompositions are shared with this cache, not copied,
+	// as they are never changed once made; the new cache grows its own from them
+	std::shared_ptr<FactorCache> leading(int n);
+};
+
+#endif
@@ -5,6 +5,7 @@
  * DATE         AUTHOR           CHANGES
  * ================================================================
  * 17/12/15     Robert Shaw      Original code. 
+ * 18/10/26     agent            Overlap gradient.
  *
  *************************************************************************************/
 
@@ -76,5 +77,21 @@ double Gaussian::overlap(const Gaussian& other) const
 	return K*norm*other.norm*pow(p, 1.5);
 }
 
+// Calculate the overlap, and its gradient, reusing the separation and
+// exponential. As S = K N_a N_b (pi/p)^(3/2), with K = exp(-mu |A - B|^2),
+// dS/dA = 2 mu (B - A) S.
+double Gaussian::overlap(const Gaussian& other, double grad[3]) const
+{
+	double dist[3];
+	for (int i = 0; i < 3; i++) dist[i] = other.pos[i] - pos[i];
+	double r2 = std::inner_product(dist, dist + 3, dist, 0.0);
 
+	double p = zeta + other.zeta; // Total exponent
+	double mu = zeta*other.zeta/p; // Reduced exponent
+	double K = exp( -mu * r2 ); // Pre-exponential factor
+	p = M_PI /p; // Reuse the variable
 
+	double S = K*norm*other.norm*pow(p, 1.5);
+	for (int i = 0; i < 3; i++) grad[i] = 2.0*mu*dist[i]*S;
+	return S;
+}
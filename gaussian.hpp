@@ -16,11 +16,16 @@
  *                              from this gaussian to the other_gaussian
  *                overlap(other_gaussian) - calculates the overlap of this
  *                              and other_gaussian
+ *                overlap(other_gaussian, grad) - as above, also calculating its
+ *                              gradient with respect to the coordinates of this
+ *                              gaussian
  *
  *
  * DATE        AUTHOR           CHANGES
  * ========================================================
  * 17/12/15    Robert Shaw      Original code. 
+ * 18/10/26    agent            Single coordinate accessor.
+ * 18/10/26    agent            Overlap gradient.
  *
  ***************************************************************************/
 
@@ -44,6 +49,7 @@ public:
 	// Accessors
 	// Get-accessors are const so that variables cannot be altered
 	std::vector<double> getCoords() const { return pos; }
+	double getCoord(int i) const { return pos[i]; } // i = 0, 1, 2 for x, y, z
 	double getZeta() const { return zeta; }
 	double getNorm() const { return norm; }
 
@@ -58,6 +64,11 @@ public:
 
 	// Calculate overlap integral between two gaussians
 	virtual double overlap(const Gaussian& other) const;
+
+	// As above, also putting its derivatives with respect to the x-, y-, and
+	// z-coordinates of this gaussian into grad (those with respect to the
+	// coordinates of other are the negatives of these)
+	virtual double overlap(const Gaussian& other, double grad[3]) const;
 };
 	
 #endif
@@ -0,0 +1,339 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement class HMatrix
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ *
+ ***************************************************************************************/
+
+#include "hmatrix.hpp"
+#include "system.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Constructor - build the cluster tree, then the blocks
+HMatrix::HMatrix(const System& sys_, double tolerance_, int leafSize_, double eta_) :
+	sys(sys_), tolerance(tolerance_), eta(eta_), leafSize(std::max(1, leafSize_))
+{
+	int N = sys.getN();
+	perm.resize(N);
+	for (int i = 0; i < N; i++) perm[i] = i;
+
+	if (N > 0) {
+		makeCluster(0, N);
+		makeBlocks(0, 0);
+	}
+}
+
+// Make the cluster of perm[begin] to perm[end-1], and its children,
+// returning its index
+int HMatrix::makeCluster(int begin, int end)
+{
+	Cluster c;
+	c.begin = begin; c.end = end;
+	c.child[0] = c.child[1] = -1;
+	for (int k = 0; k < 3; k++){
+		c.lo[k] = c.hi[k] = sys.getGaussian(perm[begin]).getCoord(k);
+		for (int p = begin+1; p < end; p++){
+			double x = sys.getGaussian(perm[p]).getCoord(k);
+			c.lo[k] = std::min(c.lo[k], x);
+			c.hi[k] = std::max(c.hi[k], x);
+		}
+	}
+
+	int id = clusters.size();
+	clusters.push_back(c);
+
+	if (end - begin > leafSize) {
+		// Split at the median along the longest side
+		int axis = 0;
+		for (int k = 1; k < 3; k++)
+			if (c.hi[k] - c.lo[k] > c.hi[axis] - c.lo[axis]) axis = k;
+		int mid = begin + (end - begin)/2;
+		const System& s = sys;
+		std::nth_element(perm.begin() + begin, perm.begin() + mid, perm.begin() + end,
+						 [&s, axis](int a, int b){
+							 return s.getGaussian(a).getCoord(axis) < s.getGaussian(b).getCoord(axis);
+						 });
+
+		int left = makeCluster(begin, mid);
+		int right = makeCluster(mid, end);
+		clusters[id].child[0] = left;
+		clusters[id].child[1] = right;
+	}
+	return id;
+}
+
+// Length of the diagonal of a cluster's bounding box
+double HMatrix::diameter(int s) const
+{
+	const Cluster& c = clusters[s];
+	double d2 = 0.0;
+	for (int k = 0; k < 3; k++) d2 += (c.hi[k] - c.lo[k])*(c.hi[k] - c.lo[k]);
+	return sqrt(d2);
+}
+
+// Distance between the bounding boxes of two clusters
+double HMatrix::distance(int s, int t) const
+{
+	const Cluster& a = clusters[s];
+	const Cluster& b = clusters[t];
+	double d2 = 0.0;
+	for (int k = 0; k < 3; k++){
+		double gap = std::max(0.0, std::max(a.lo[k] - b.hi[k], b.lo[k] - a.hi[k]));
+		d2 += gap*gap;
+	}
+	return sqrt(d2);
+}
+
+// Make the blocks between clusters s and t, where s == t, or s and t are disjoint
+void HMatrix::makeBlocks(int s, int t)
+{
+	const Cluster& cs = clusters[s];
+	const Cluster& ct = clusters[t];
+	bool sLeaf = (cs.child[0] < 0), tLeaf = (ct.child[0] < 0);
+
+	if (s == t) {
+		if (sLeaf) {
+			Block b;
+			b.row = s; b.col = t; b.lowRank = false;
+			denseBlock(s, t, b.dense);
+			blocks.push_back(b);
+		} else {
+			// The upper off-diagonal block is the transpose of the lower
+			int c0 = cs.child[0], c1 = cs.child[1];
+			makeBlocks(c0, c0);
+			makeBlocks(c1, c0);
+			makeBlocks(c1, c1);
+		}
+		return;
+	}
+
+	if (std::min(diameter(s), diameter(t)) <= eta*distance(s, t)) {
+		Block b;
+		b.row = s; b.col = t; b.lowRank = true;
+		if (!crossApproximation(s, t, b.U, b.V)) {
+			// Not worth storing as low-rank
+			b.lowRank = false;
+			b.U.resize(0, 0); b.V.resize(0, 0);
+			denseBlock(s, t, b.dense);
+		}
+		blocks.push_back(b);
+	} else if (sLeaf && tLeaf) {
+		Block b;
+		b.row = s; b.col = t; b.lowRank = false;
+		denseBlock(s, t, b.dense);
+		blocks.push_back(b);
+	} else if (tLeaf || (!sLeaf && cs.end - cs.begin >= ct.end - ct.begin)) {
+		int c0 = cs.child[0], c1 = cs.child[1];
+		makeBlocks(c0, t);
+		makeBlocks(c1, t);
+	} else {
+		int c0 = ct.child[0], c1 = ct.child[1];
+		makeBlocks(s, c0);
+		makeBlocks(s, c1);
+	}
+}
+
+// Every integral in the block between clusters s and t
+void HMatrix::denseBlock(int s, int t, Eigen::MatrixXd& B) const
+{
+	const Cluster& cs = clusters[s];
+	const Cluster& ct = clusters[t];
+	B.resize(cs.end - cs.begin, ct.end - ct.begin);
+	for (int q = ct.begin; q < ct.end; q++){
+		const Gaussian& g = sys.getGaussian(perm[q]);
+		for (int p = cs.begin; p < cs.end; p++)
+			B(p - cs.begin, q - ct.begin) = sys.getGaussian(perm[p]).overlap(g);
+	}
+}
+
+// Adaptive cross approximation with partial pivoting. Each step takes the
+// residual of one row, pivots on its largest element, and takes the residual
+// of that column, giving a rank-one term u v^T. This stops once the term is
+// below tolerance relative to (an estimate of) the norm of the approximation.
+// Returns false if the rank grows so large that a dense block would be smaller.
+bool HMatrix::crossApproximation(int s, int t, Eigen::MatrixXd& U, Eigen::MatrixXd& V) const
+{
+	const Cluster& cs = clusters[s];
+	const Cluster& ct = clusters[t];
+	int m = cs.end - cs.begin, n = ct.end - ct.begin;
+	int maxRank = (m*n)/(m + n);
+
+	U.resize(m, std::min(maxRank, 8));
+	V.resize(n, U.cols());
+	std::vector<bool> rowUsed(m, false);
+	Eigen::VectorXd row(n), col(m);
+	double norm2 = 0.0;
+	int rank = 0, i = 0;
+
+	while (true) {
+		// Residual of row i
+		rowUsed[i] = true;
+		const Gaussian& gi = sys.getGaussian(perm[cs.begin + i]);
+		for (int q = 0; q < n; q++) row(q) = gi.overlap(sys.getGaussian(perm[ct.begin + q]));
+		row -= V.leftCols(rank) * U.row(i).head(rank).transpose();
+
+		int j;
+		double pivot = row.cwiseAbs().maxCoeff(&j);
+		if (pivot > 0.0) {
+			if (rank >= maxRank) return false;
+			if (rank == U.cols()) {
+				int cols = std::min(maxRank, 2*rank);
+				U.conservativeResize(Eigen::NoChange, cols);
+				V.conservativeResize(Eigen::NoChange, cols);
+			}
+
+			// Residual of column j
+			const Gaussian& gj = sys.getGaussian(perm[ct.begin + j]);
+			for (int p = 0; p < m; p++) col(p) = sys.getGaussian(perm[cs.begin + p]).overlap(gj);
+			col -= U.leftCols(rank) * V.row(j).head(rank).transpose();
+
+			V.col(rank) = row / row(j);
+			U.col(rank) = col;
+
+			// ||A + uv^T||^2 = ||A||^2 + 2 sum_k (u.U_k)(v.V_k) + |u|^2 |v|^2
+			double unorm = U.col(rank).norm(), vnorm = V.col(rank).norm();
+			for (int k = 0; k < rank; k++)
+				norm2 += 2.0 * U.col(k).dot(U.col(rank)) * V.col(k).dot(V.col(rank));
+			norm2 += unorm*unorm*vnorm*vnorm;
+			rank++;
+
+			if (unorm*vnorm <= tolerance*sqrt(std::abs(norm2))) break;
+		}
+
+		// Next row - the largest element of the last column, if not used,
+		// or otherwise the first unused row
+		int next = -1;
+		double best = -1.0;
+		if (pivot > 0.0)
+			for (int p = 0; p < m; p++)
+				if (!rowUsed[p] && std::abs(U(p, rank-1)) > best) { best = std::abs(U(p, rank-1)); next = p; }
+		if (next < 0)
+			for (int p = 0; p < m && next < 0; p++)
+				if (!rowUsed[p]) next = p;
+		if (next < 0) break; // Every row used, so the approximation is exact
+		i = next;
+	}
+
+	U.conservativeResize(Eigen::NoChange, rank);
+	V.conservativeResize(Eigen::NoChange, rank);
+	return true;
+}
+
+int HMatrix::getNDense() const
+{
+	int n = 0;
+	for (int b = 0; b < blocks.size(); b++) if (!blocks[b].lowRank) n++;
+	return n;
+}
+
+int HMatrix::getNLowRank() const
+{
+	return blocks.size() - getNDense();
+}
+
+int HMatrix::getMaxRank() const
+{
+	int r = 0;
+	for (int b = 0; b < blocks.size(); b++)
+		if (blocks[b].lowRank) r = std::max(r, (int) blocks[b].U.cols());
+	return r;
+}
+
+double HMatrix::getMeanRank() const
+{
+	double total = 0.0;
+	int n = 0;
+	for (int b = 0; b < blocks.size(); b++)
+		if (blocks[b].lowRank) { total += blocks[b].U.cols(); n++; }
+	return (n > 0 ? total/n : 0.0);
+}
+
+// Number of doubles stored in the blocks
+long long HMatrix::storage() const
+{
+	long long total = 0;
+	for (int b = 0; b < blocks.size(); b++)
+		total += blocks[b].dense.size() + blocks[b].U.size() + blocks[b].V.size();
+	return total;
+}
+
+// y = H x, applying each off-diagonal block and its transpose
+void HMatrix::multiply(const Eigen::VectorXd& x, Eigen::VectorXd& y) const
+{
+	int N = size();
+	Eigen::VectorXd xp(N), yp = Eigen::VectorXd::Zero(N);
+	for (int p = 0; p < N; p++) xp(p) = x(perm[p]);
+
+	for (int k = 0; k < blocks.size(); k++){
+		const Block& b = blocks[k];
+		const Cluster& cs = clusters[b.row];
+		const Cluster& ct = clusters[b.col];
+		int m = cs.end - cs.begin, n = ct.end - ct.begin;
+
+		if (b.row == b.col) {
+			yp.segment(cs.begin, m).noalias() += b.dense * xp.segment(ct.begin, n);
+		} else if (b.lowRank) {
+			yp.segment(cs.begin, m).noalias() += b.U * (b.V.transpose() * xp.segment(ct.begin, n));
+			yp.segment(ct.begin, n).noalias() += b.V * (b.U.transpose() * xp.segment(cs.begin, m));
+		} else {
+			yp.segment(cs.begin, m).noalias() += b.dense * xp.segment(ct.begin, n);
+			yp.segment(ct.begin, n).noalias() += b.dense.transpose() * xp.segment(cs.begin, m);
+		}
+	}
+
+	y.resize(N);
+	for (int p = 0; p < N; p++) y(perm[p]) = yp(p);
+}
+
+// Sum the integrals into the blocks of the sparse graph. Each pair of functions
+// is in exactly one stored block, once. The sum of a low-rank block over the
+// rows in graph block a and columns in graph block b is
+//      sum_k (sum of U_k over those rows) (sum of V_k over those columns)
+// so only the sums of U and V over each graph block are needed.
+std::vector<std::vector<double> > HMatrix::densities(int blocksize, int nblocks) const
+{
+	std::vector<std::vector<double> > d(nblocks, std::vector<double>(nblocks, 0.0));
+
+	for (int k = 0; k < blocks.size(); k++){
+		const Block& b = blocks[k];
+		const Cluster& cs = clusters[b.row];
+		const Cluster& ct = clusters[b.col];
+		int m = cs.end - cs.begin, n = ct.end - ct.begin;
+
+		if (!b.lowRank) {
+			for (int q = 0; q < n; q++){
+				int j = perm[ct.begin + q];
+				// Only the lower triangle of a diagonal block
+				for (int p = (b.row == b.col ? q : 0); p < m; p++){
+					int i = perm[cs.begin + p];
+					d[std::min(i, j)/blocksize][std::max(i, j)/blocksize] += b.dense(p, q);
+				}
+			}
+		} else {
+			// Sums of the columns of U and V over each graph block
+			std::vector<int> rowBins, colBins;
+			for (int p = 0; p < m; p++) rowBins.push_back(perm[cs.begin + p]/blocksize);
+			for (int q = 0; q < n; q++) colBins.push_back(perm[ct.begin + q]/blocksize);
+			std::vector<int> rb(rowBins), cb(colBins);
+			std::sort(rb.begin(), rb.end()); rb.erase(std::unique(rb.begin(), rb.end()), rb.end());
+			std::sort(cb.begin(), cb.end()); cb.erase(std::unique(cb.begin(), cb.end()), cb.end());
+
+			Eigen::MatrixXd Usum = Eigen::MatrixXd::Zero(rb.size(), b.U.cols());
+			Eigen::MatrixXd Vsum = Eigen::MatrixXd::Zero(cb.size(), b.V.cols());
+			for (int p = 0; p < m; p++)
+				Usum.row(std::lower_bound(rb.begin(), rb.end(), rowBins[p]) - rb.begin()) += b.U.row(p);
+			for (int q = 0; q < n; q++)
+				Vsum.row(std::lower_bound(cb.begin(), cb.end(), colBins[q]) - cb.begin()) += b.V.row(q);
+
+			Eigen::MatrixXd sums = Usum * Vsum.transpose();
+			for (int r = 0; r < rb.size(); r++)
+				for (int c = 0; c < cb.size(); c++)
+					d[std::min(rb[r], cb[c])][std::max(rb[r], cb[c])] += sums(r, c);
+		}
+	}
+	return d;
+}
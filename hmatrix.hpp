@@ -0,0 +1,99 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To provide a hierarchical (H-matrix) representation of the overlap matrix,
+ *          for loose thresholds or diffuse exponents, where the overlap is nearly
+ *          dense and the packed storage of a System grows as N^2.
+ *
+ *          The Gaussians are split into a tree of clusters by repeatedly bisecting
+ *          their bounding box along its longest side. A block of the overlap between
+ *          two clusters that are far apart compared with their size is numerically
+ *          low-rank, so is stored as U V^T, found by adaptive cross approximation
+ *          (ACA) with partial pivoting to a relative tolerance; other blocks are split
+ *          between the clusters' children, down to dense blocks between leaves.
+ *          Only the blocks on or below the diagonal of the block tree are stored, the
+ *          others being their transposes. No integral is stored unless it is needed,
+ *          so the System's overlap does not have to have been calculated.
+ *
+ * CONTAINS:
+ *          class HMatrix:
+ *              data:
+ *                  perm - the Gaussian indices in cluster order
+ *                  clusters - the cluster tree, each cluster a range of perm
+ *                  blocks - the dense and low-rank blocks
+ *              routines:
+ *                  multiply(x, y) - y = H x, with x and y in the System's order
+ *                  densities(blocksize, nblocks) - the sums of the integrals in each
+ *                                  block of the lower triangle, as for the sparse graph
+ *                  getNDense(), getNLowRank() - the number of each kind of block
+ *                  getMaxRank(), getMeanRank() - the ranks of the low-rank blocks
+ *                  storage() - the number of doubles stored
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 18/10/26     agent            Original code.
+ *
+ ************************************************************************************/
+
+#ifndef HMATRIXHEADERDEF
+#define HMATRIXHEADERDEF
+
+#include <Eigen/Dense>
+#include <vector>
+
+// Declare forward dependencies
+class System;
+
+class HMatrix
+{
+private:
+	struct Cluster {
+		int begin, end; // Range of perm
+		double lo[3], hi[3]; // Bounding box
+		int child[2]; // Children, or -1 for a leaf
+	};
+
+	// The block between clusters row and col. Diagonal blocks (row == col) are
+	// dense and symmetric; the others stand for themselves and their transpose.
+	struct Block {
+		int row, col;
+		bool lowRank;
+		Eigen::MatrixXd dense; // Only for dense blocks
+		Eigen::MatrixXd U, V; // Only for low-rank blocks, block = U V^T
+	};
+
+	const System& sys;
+	double tolerance, eta;
+	int leafSize;
+	std::vector<int> perm;
+	std::vector<Cluster> clusters;
+	std::vector<Block> blocks;
+
+	int makeCluster(int begin, int end);
+	void makeBlocks(int s, int t);
+	double diameter(int s) const;
+	double distance(int s, int t) const;
+	bool crossApproximation(int s, int t, Eigen::MatrixXd& U, Eigen::MatrixXd& V) const;
+	void denseBlock(int s, int t, Eigen::MatrixXd& B) const;
+public:
+	// Build with the given ACA tolerance, maximum leaf size, and admissibility
+	// parameter eta, a block being low-rank if min(diameters) <= eta * distance
+	HMatrix(const System& sys_, double tolerance_, int leafSize_ = 32, double eta_ = 1.0);
+
+	int size() const { return perm.size(); }
+	double getTolerance() const { return tolerance; }
+	int getLeafSize() const { return leafSize; }
+	int getNClusters() const { return clusters.size(); }
+	int getNDense() const;
+	int getNLowRank() const;
+	int getMaxRank() const;
+	double getMeanRank() const;
+	long long storage() const;
+
+	void multiply(const Eigen::VectorXd& x, Eigen::VectorXd& y) const;
+
+	// densities[a][b] (a <= b) is the sum of the integrals S_ij, j <= i,
+	// with j in the ath and i in the bth range of blocksize functions
+	std::vector<std::vector<double> > densities(int blocksize, int nblocks) const;
+};
+
+#endif
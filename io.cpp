@@ -5,15 +5,46 @@
  * DATE           AUTHOR             CHANGES 
  * ==================================================================================
  * 19/12/15       Robert Shaw        Original code.
+ * 18/10/26       agent              Condition number command.
+ * 18/10/26       agent              Threshold sweep command.
+ * 18/10/26       agent              Sampling sparsity estimate command.
+ * 18/10/26       agent              Local window orthogonalisation command.
+ * 18/10/26       agent              Number of overlap shards.
+ * 18/10/26       agent              H-matrix command and sparse graph.
+ * 18/10/26       agent              Sparse graph pyramid command.
+ * 18/10/26       agent              Compressed storage, and its bytes per non-zero.
+ * 18/10/26       agent              Overlap gradient command.
+ * 18/10/26       agent              Periodic cell.
+ * 18/10/26       agent              Bulk output through a TextWriter.
+ * 18/10/26       agent              Lazy rows, and their cache statistics.
+ * 18/10/26       agent              Partial-spectrum canonical orthogonalisation.
+ * 18/10/26       agent              Choice of eigensolver for orthogonalisation.
+ * 18/10/26       agent              Comparison with other systems by their overlap.
+ * 19/10/26       agent              Execution plan, and turning the planner off.
+ * 19/10/26       agent              Plan printed only with plan, print.
+ * 19/10/26       agent              Plan always printed; its timings only with plan, print.
+ * 19/10/26       agent              Columns read through RowReader::col.
  *
  **********************************************************************************************/
 
 #include "io.hpp"
 #include "system.hpp"
 #include "gaussian.hpp"
+#include "estimate.hpp"
+#include "windows.hpp"
+#include "hmatrix.hpp"
+#include "storage.hpp"
+#include "spatial.hpp"
+#include "writer.hpp"
+#include "eigensolver.hpp"
+#include "compare.hpp"
+#include "planner.hpp"
 #include <algorithm>
 #include <iostream>
 #include <iomanip>
+#include <functional>
+#include <cmath>
+#include <random>
 
 // Match token to a particular command
 int findToken(std::string t)
@@ -36,14 +67,71 @@ int findToken(std::string t)
 	else if (t == "canonical") { rval = 8; }
 	else if (t == "gramschmidt") { rval = 9; }
 	else if (t == "symlowdin") { rval = 10; }
+	else if (t == "condition") { rval = 11; }
+	else if (t == "sweep") { rval = 12; }
+	else if (t == "range") { rval = 13; }
+	else if (t == "estimate") { rval = 14; }
+	else if (t == "windows") { rval = 15; }
+	else if (t == "radius") { rval = 16; }
+	else if (t == "list") { rval = 17; }
+	else if (t == "shards") { rval = 18; }
+	else if (t == "hmatrix") { rval = 19; }
+	else if (t == "pyramid") { rval = 20; }
+	else if (t == "compress") { rval = 21; }
+	else if (t == "quantise") { rval = 22; }
+	else if (t == "gradient") { rval = 23; }
+	else if (t == "cell") { rval = 24; }
+	else if (t == "lazy") { rval = 25; }
+	else if (t == "parallel") { rval = 26; }
+	else if (t == "compare") { rval = 27; }
+	else if (t == "plan") { rval = 28; }
+	else if (t == "off") { rval = 29; }
 
 	return rval;
 }
 
-// Read the basis, geom, and threshold, to make the system
+// Split a comma-separated argument list into its arguments,
+// removing any spaces, and ignoring empty arguments
+static std::vector<std::string> splitArgs(std::string args)
+{
+	args.erase(std::remove(args.begin(), args.end(), ' '), args.end());
+
+	std::vector<std::string> words;
+	std::string word;
+	std::size_t start = 0, end;
+	while (start <= args.length()) {
+		end = args.find(',', start);
+		if (end == std::string::npos) end = args.length();
+		word = args.substr(start, end - start);
+		if (word.length() > 0) words.push_back(word);
+		start = end + 1;
+	}
+	return words;
+}
+
+// Read the basis, geom, threshold, shards, compression, cell, and laziness, to make the system
 System makeSystem(std::ifstream& in)
 {
+	PlanPins pins;
+	return makeSystem(in, pins);
+}
+
+// As above; the storage and worker processes are pinned if given, the planner
+// can be turned off altogether with plan, off, and the timings of the machine it
+// was made from printed with plan, print
+System makeSystem(std::ifstream& in, PlanPins& pins)
+{
+	pins.enabled = true;
+	pins.storage = false;
+	pins.shards = false;
+	pins.print = false;
 	double threshold = 1e-4; // Default threshold value
+	int shards = 1; // Default is to calculate the overlap in this process
+	bool compress = false; // Default is to store the integrals uncompressed
+	double quantise = 0.0; // and if compressed, exactly
+	std::vector<double> cell; // Default is an isolated cluster
+	bool lazy = false; // Default is to calculate the whole overlap up front
+	double cacheSize = 64.0; // and if lazy, to cache up to 64 MB of rows
 	int geomstart = 0; int geomend = 0;
 	int basisstart = 0; int basisend = 0;
 
@@ -96,6 +184,43 @@ System makeSystem(std::ifstream& in)
 				threshold = std::stod(line.substr(pos+1, line.length()));
 				break;
 			}
+			case 18: { // Number of worker processes for the overlap
+				shards = std::stoi(line.substr(pos+1, line.length()));
+				pins.shards = true;
+				break;
+			}
+			case 21: { // Compressed storage, exact or quantised
+				std::vector<std::string> args = splitArgs(line.substr(pos+1, line.length()));
+				compress = true;
+				if (args.size() > 1 && findToken(args[0]) == 22) quantise = std::stod(args[1]);
+				pins.storage = true;
+				break;
+			}
+			case 25: { // Lazy rows, and the size of their cache in MB
+				std::vector<std::string> args = splitArgs(line.substr(pos+1, line.length()));
+				lazy = true;
+				if (args.size() > 0) cacheSize = std::stod(args[0]);
+				pins.storage = true;
+				break;
+			}
+			case 28: { // Planner, which is on unless turned off; its timings only printed if asked
+				std::vector<std::string> args = splitArgs(line.substr(pos+1, line.length()));
+				for (int k = 0; k < args.size(); k++){
+					if (findToken(args[k]) == 29) pins.enabled = false;
+					else if (findToken(args[k]) == 4) pins.print = true;
+				}
+				break;
+			}
+			case 24: { // Periodic cell - the lattice vectors, one per line, until cellend
+				cell.clear();
+				while (std::getline(in, line) && line != "cellend") {
+					linecount++;
+					std::vector<std::string> args = splitArgs(line.substr(0, line.find('!')));
+					for (int k = 0; k < args.size(); k++) cell.push_back(std::stod(args[k]));
+				}
+				linecount++;
+				break;
+			}
    			}
 		}
 		linecount ++;
@@ -103,6 +228,12 @@ System makeSystem(std::ifstream& in)
 
 	// Make the system
 	System sys(threshold);
+	sys.setShards(shards);
+	sys.setCompression(compress, quantise);
+	sys.setLazy(lazy, cacheSize);
+	if (!cell.empty() && !sys.setCell(cell))
+		std::cerr << "The cell must be three lattice vectors that span space.\n"
+				  << "Treating the system as an isolated cluster instead.\n";
 
 	// Read the basis and geometry, if they've been specified correctly
 	if ( (basisend - basisstart) > 0 && (geomend - geomstart) > 0) {
@@ -186,11 +317,43 @@ void addAtomType(std::ifstream& in, System& sys, std::string atomtype_,
 // 0 = no more commands
 // 1 = print integrals
 // 2, fineness = print sparsegraph
-// 3, n = canonical orthog. first n funcs
-// 4, n = gram-schmidt orthog. first n funcs
-// 5, n = sym. lowdin orthog. first n funcs
+// 3, n, solver = canonical orthog. first n funcs, removing those with overlap
+//                eigenvalues below the cutoff in params, if given
+// 4, n, solver = gram-schmidt orthog. first n funcs
+// 5, n, solver = sym. lowdin orthog. first n funcs
+//    (solver is the eigensolver used, SERIAL_EIGEN or PARALLEL_EIGEN)
+// 6, steps = estimate condition number with at most steps Lanczos iterations
+// 7 = threshold sweep, with the thresholds (in descending order) in params
+// 8, samples = sampling estimate of sparsity, with the confidence level in params
+// 9, type, stride = orthogonalise local windows by method type (numbered as for
+//                   printOrthog), either around every stride-th function with the
+//                   radius in params, or if stride is 0, given as lists of functions
+//                   in params (see listWindows)
+// 10, fineness, leafsize = H-matrix of the overlap, with the tolerance in params,
+//                          and its sparse graph if fineness > 0
+// 11, fineness, tilesize = print the sparse graph pyramid, from fineness pixels across
+// 12 = print the gradient of the overlap integrals
+// 13 = compare with the systems in the input files returned in names
 std::vector<int> getNextCmd(std::ifstream& in, int lastCmd_)
 {
+	std::vector<double> params;
+	return getNextCmd(in, lastCmd_, params);
+}
+
+// As above, also returning any real-valued parameters of the command
+std::vector<int> getNextCmd(std::ifstream& in, int lastCmd_, std::vector<double>& params)
+{
+	std::vector<std::string> names;
+	return getNextCmd(in, lastCmd_, params, names);
+}
+
+// As above, also returning any file names given to the command
+std::vector<int> getNextCmd(std::ifstream& in, int lastCmd_, std::vector<double>& params,
+							std::vector<std::string>& names)
+{
+	params.clear();
+	names.clear();
+
     // Rewind to beginning of file
 	in.clear();
 	in.seekg(0, std::ios::beg);
@@ -244,6 +407,22 @@ std::vector<int> getNextCmd(std::ifstream& in, int lastCmd_)
 						cmd.push_back(std::stoi(token));
 						break;
 					}
+					case 23: { // Print gradient of the overlap integrals
+						cmd.push_back(12);
+						break;
+					}
+					case 20: { // Print sparse graph pyramid
+						std::vector<std::string> args = splitArgs(line.substr(pos+1, line.length()));
+						if (args.size() < 2) {
+							std::cerr << "Sparse graph pyramid needs a fineness.\n";
+							cmd.push_back(-1);
+						} else {
+							cmd.push_back(11);
+							cmd.push_back(std::stoi(args[1]));
+							cmd.push_back(args.size() > 2 ? std::stoi(args[2]) : 256);
+						}
+						break;
+					}
 					default: {
 						std::cerr << "Invalid print command\n";
 						cmd.push_back(-1);
@@ -262,15 +441,27 @@ std::vector<int> getNextCmd(std::ifstream& in, int lastCmd_)
 					pos = line.find(',');
 					if (pos != std::string::npos){
 						token = line.substr(0, pos);
-						int nfuncs = std::stoi(line.substr(pos+1, line.length()));
+						std::vector<std::string> args = splitArgs(line.substr(pos+1, line.length()));
+						int nfuncs = (args.size() > 0 ? std::stoi(args[0]) : 0);
+
+						// Any other arguments are the cutoff, and the eigensolver
+						std::vector<double> cutoff;
+						int solver = SERIAL_EIGEN;
+						for (int a = 1; a < args.size(); a++){
+							if (findToken(args[a]) == 26) solver = PARALLEL_EIGEN;
+							else cutoff.push_back(std::stod(args[a]));
+						}
 											   
 						switch(findToken(token)){
-						case 8: { // Canonical
+						case 8: { // Canonical, with the near-linear dependency cutoff if given
 							cmd.push_back(3);
+							if (cutoff.size() > 0) params.push_back(cutoff[0]);
 							break;
 						}
 						case 9: { // Gram-Schmidt
 							cmd.push_back(4);
+							if (solver == PARALLEL_EIGEN)
+								std::cerr << "Gram-Schmidt needs no eigensolver; ignoring parallel.\n";
 							break;
 						}
 						case 10: { // Symmetric Lowdin
@@ -284,6 +475,7 @@ std::vector<int> getNextCmd(std::ifstream& in, int lastCmd_)
 						}
 
 						cmd.push_back(nfuncs);
+						cmd.push_back(solver);
 					} else {
 						std::cerr << "No orthogonalisation method specified!\n";
 						cmd.push_back(-1);
@@ -291,6 +483,163 @@ std::vector<int> getNextCmd(std::ifstream& in, int lastCmd_)
 				}
 				break;
 			}
+			case 11: { // Condition number command
+				cmdcount++;
+
+				// Is this the next command?
+				if (cmdcount == lastCmd_+1){
+					cmd.push_back(6);
+
+					// Number of Lanczos steps, if given
+					int steps = 50;
+					token = line.substr(pos+1, line.length());
+					token.erase(std::remove(token.begin(), token.end(), ' '), token.end());
+					if (token.length() > 0) steps = std::stoi(token);
+					cmd.push_back(steps);
+				}
+				break;
+			}
+			case 12: { // Threshold sweep
+				cmdcount++;
+
+				// Is this the next command?
+				if (cmdcount == lastCmd_+1){
+					std::vector<std::string> args = splitArgs(line.substr(pos+1, line.length()));
+					if (args.size() > 0 && findToken(args[0]) == 13) {
+						// Range of thresholds, evenly spaced in log10,
+						// with a given number per decade (default 1)
+						if (args.size() < 3) {
+							std::cerr << "Sweep range needs a largest and smallest threshold.\n";
+							cmd.push_back(-1);
+						} else {
+							double tmax = log10(std::stod(args[1]));
+							double tmin = log10(std::stod(args[2]));
+							if (tmax < tmin) std::swap(tmax, tmin);
+							int perDecade = (args.size() > 3 ? std::stoi(args[3]) : 1);
+							if (perDecade < 1) perDecade = 1;
+							int nsteps = (int) round((tmax - tmin)*perDecade);
+							for (int i = 0; i <= nsteps; i++)
+								params.push_back(pow(10.0, tmax - (double) i/perDecade));
+							cmd.push_back(7);
+						}
+					} else {
+						// Explicit list of thresholds
+						for (int i = 0; i < args.size(); i++) params.push_back(std::stod(args[i]));
+						std::sort(params.begin(), params.end(), std::greater<double>());
+						if (params.size() > 0) cmd.push_back(7);
+						else {
+							std::cerr << "No thresholds given to sweep.\n";
+							cmd.push_back(-1);
+						}
+					}
+				}
+				break;
+			}
+			case 14: { // Sparsity estimate
+				cmdcount++;
+
+				// Is this the next command?
+				if (cmdcount == lastCmd_+1){
+					// Number of samples, and confidence level, if given
+					std::vector<std::string> args = splitArgs(line.substr(pos+1, line.length()));
+					cmd.push_back(8);
+					cmd.push_back(args.size() > 0 ? std::stoi(args[0]) : 100000);
+					params.push_back(args.size() > 1 ? std::stod(args[1]) : 0.95);
+				}
+				break;
+			}
+			case 15: { // Local window orthogonalisation
+				cmdcount++;
+				bool thisCmd = (cmdcount == lastCmd_+1);
+
+				std::vector<std::string> args = splitArgs(line.substr(pos+1, line.length()));
+				bool isList = (args.size() > 1 && findToken(args[1]) == 17);
+				if (thisCmd) {
+					int type = (args.size() > 0 ? findToken(args[0]) - 7 : 0);
+					if (type < 1 || type > 3) {
+						std::cerr << "Invalid windows orthogonalisation method.\n";
+						cmd.push_back(-1);
+					} else if (isList) {
+						cmd.push_back(9); cmd.push_back(type); cmd.push_back(0);
+					} else if (args.size() > 2 && findToken(args[1]) == 16) {
+						cmd.push_back(9); cmd.push_back(type);
+						cmd.push_back(args.size() > 3 ? std::stoi(args[3]) : 1);
+						params.push_back(std::stod(args[2]));
+					} else {
+						std::cerr << "Windows need a radius, or a list of functions.\n";
+						cmd.push_back(-1);
+					}
+				}
+
+				// A list is given on the following lines, up to windowsend, one
+				// window per line, as function numbers or ranges (e.g. 1, 4-9, 12).
+				// These are skipped over when looking for other commands.
+				while (isList && std::getline(in, line) && line != "windowsend") {
+					if (!thisCmd) continue;
+					pos = line.find('!');
+					if (pos != std::string::npos) line.erase(pos, line.length());
+					std::vector<std::string> entries = splitArgs(line);
+					if (entries.size() == 0) continue;
+
+					std::vector<double> window;
+					for (int e = 0; e < entries.size(); e++){
+						std::size_t dash = entries[e].find('-', 1);
+						int first = std::stoi(entries[e].substr(0, dash));
+						int last = (dash != std::string::npos ? std::stoi(entries[e].substr(dash+1)) : first);
+						for (int k = first; k <= last; k++) window.push_back(k);
+					}
+					params.push_back(window.size());
+					params.insert(params.end(), window.begin(), window.end());
+				}
+				break;
+			}
+			case 19: { // H-matrix
+				cmdcount++;
+
+				// Is this the next command?
+				if (cmdcount == lastCmd_+1){
+					// Tolerance, and optionally the sparse graph fineness and leaf size
+					std::vector<std::string> args = splitArgs(line.substr(pos+1, line.length()));
+					cmd.push_back(10);
+					cmd.push_back(args.size() > 1 ? std::stoi(args[1]) : 0);
+					cmd.push_back(args.size() > 2 ? std::stoi(args[2]) : 32);
+					params.push_back(args.size() > 0 ? std::stod(args[0]) : 1e-6);
+				}
+				break;
+			}
+			case 27: { // Compare with other systems
+				cmdcount++;
+				bool thisCmd = (cmdcount == lastCmd_+1);
+
+				std::vector<std::string> args = splitArgs(line.substr(pos+1, line.length()));
+				bool isList = (args.size() > 0 && findToken(args[0]) == 17);
+				if (thisCmd && !isList) names = args;
+
+				// A list of input files may be given on the following lines instead, up
+				// to compareend, so that thousands of systems can be compared at once.
+				// These are skipped over when looking for other commands.
+				while (isList && std::getline(in, line) && line != "compareend") {
+					if (!thisCmd) continue;
+					pos = line.find('!');
+					if (pos != std::string::npos) line.erase(pos, line.length());
+					std::vector<std::string> entries = splitArgs(line);
+					names.insert(names.end(), entries.begin(), entries.end());
+				}
+
+				if (thisCmd) {
+					if (names.size() > 0) cmd.push_back(13);
+					else {
+						std::cerr << "No systems given to compare with.\n";
+						cmd.push_back(-1);
+					}
+				}
+				break;
+			}
+			case 18: case 21: case 25: case 28: break; // Shards, compression, laziness, and planning, read by makeSystem
+			case 24: { // Periodic cell, read by makeSystem, so skipped
+				while (std::getline(in, line) && line != "cellend");
+				break;
+			}
 			default: {
 				if (id > 5 || id < 1){
 					std::cerr << "Command not found. " << id << "\n";
@@ -312,11 +661,48 @@ std::vector<int> getNextCmd(std::ifstream& in, int lastCmd_)
 void printSystem(const System& sys, std::ofstream& out, bool printBasis)
 {
 	int N = sys.getN();
-	out << "\nThis system has " << N << " basis functions\n"
-		<< "Its sparsity is: " << sys.sparsity() << " percent\n"
-		<< "with a threshold of " << sys.getThreshold() << "\n\n"
-		<< "That is equivalent to " << sys.getZeroes()
-		<< " zeroes out of " << (N*(N+1))/2 << " possible unique integrals.\n\n";
+	if (sys.hasOverlap()) {
+		out << "\nThis system has " << N << " basis functions\n"
+			<< "Its sparsity is: " << sys.sparsity() << " percent\n"
+			<< "with a threshold of " << sys.getThreshold() << "\n\n"
+			<< "That is equivalent to " << sys.getZeroes()
+			<< " zeroes out of " << (N*(N+1))/2 << " possible unique integrals.\n\n";
+		out << "The non-zero integrals take " << sys.storage()/(1024.0*1024.0) << " MB, or "
+			<< (sys.getNonZero() > 0 ? sys.storage()/sys.getNonZero() : 0.0)
+			<< " bytes per non-zero";
+		if (sys.getCompressed() && sys.getCompressed()->getStep() > 0.0)
+			out << ",\ncompressed and quantised to within " << 0.5*sys.getCompressed()->getStep();
+		else if (sys.getCompressed())
+			out << ",\ncompressed";
+		out << ".\n\n";
+		if (sys.getShards() > 1)
+			out << "The overlap matrix was calculated in " << sys.getShards()
+				<< " shards, by separate worker processes.\n\n";
+		if (sys.isPeriodic()) {
+			const std::vector<double>& cell = sys.getCell();
+			out << "The system is periodic, with lattice vectors\n";
+			for (int k = 0; k < 3; k++)
+				out << "    " << cell[3*k] << ", " << cell[3*k+1] << ", " << cell[3*k+2] << "\n";
+			// Images are screened at the lowest threshold wanted
+			double screen = sys.getThreshold();
+			if (!sys.getSweepThresholds().empty())
+				screen = std::min(screen, sys.getSweepThresholds().front());
+			out << "and each integral is summed over the lattice images within "
+				<< cutoffRadius(sys, screen) << " of each other.\n\n";
+		}
+		if (sys.hasGradient())
+			out << "Their gradients take a further "
+				<< sys.sGrads.size()*sizeof(double)/(1024.0*1024.0) << " MB.\n\n";
+	} else if (sys.getRowCache()) {
+		out << "\nThis system has " << N << " basis functions\n"
+			<< "Its overlap matrix is calculated a row at a time, as needed,\n"
+			<< "with a threshold of " << sys.getThreshold() << "\n\n"
+			<< "At most " << sys.getCacheSize() << " MB of rows are kept in a cache.\n\n";
+	} else {
+		out << "\nThis system has " << N << " basis functions\n"
+			<< "Its overlap matrix has not been calculated\n"
+			<< "with a threshold of " << sys.getThreshold() << "\n\n";
+	}
 
 	// Print details of the basis functions, if wanted
 	if (printBasis) {
@@ -348,98 +734,158 @@ void printGaussian(const Gaussian& g, std::ofstream& out)
 void printIntegrals(const System& sys, std::ofstream& out)
 {
 	int N = sys.getN();
-	out << "NON-ZERO INTEGRALS: " << (N*(N+1))/2 - sys.getZeroes() << "\n\n";
+	if (sys.hasOverlap()) out << "NON-ZERO INTEGRALS: " << (N*(N+1))/2 - sys.getZeroes() << "\n\n";
+	else out << "NON-ZERO INTEGRALS: calculated as needed\n\n";
 	
 	out << std::setw(8) << "Row"
 		<< std::setw(8) << "Column"
 		<< std::setw(20) << "Integral\n"
 		<< std::string(36, '.') << "\n";
 
-	out << std::setprecision(8);
-
 	// Loop through rows and columns in order
-	int currIndex = 1; 
-	int position = 0;
+	TextWriter text(out);
+	RowReader reader(sys);
 	for (int i = 0; i < N; i++){
-		for (int j = 0; j < i+1; j++){
-			if (sys.sIndices[position] == currIndex){
-				out << std::setw(8) << j+1
-					<< std::setw(8) << i+1
-					<< std::setw(20) << sys.sInts[position] << "\n";
-
-				position++;
-				if (position >= sys.sInts.size()) {
-					j = i+1;
-					i = N;
-				}
-			}
-			currIndex++;
+		int count = reader.read(i);
+		for (int k = 0; k < count; k++){
+			text.putInt(reader.col(k)+1, 8);
+			text.putInt(i+1, 8);
+			text.putDouble(reader.vals[k], 20, 8);
+			text.put('\n');
 		}
 	}
 }			
 
-// Print out the sparse graph data
-// This data is used to make a greyscale graph in which
-// the density of the matrix is represented by darkness
-// fineness controls the size of the blocks, where for example
-// 100 would give blocks of size [N/100]
-void printSparseGraph(const System& sys, std::ofstream& out, int fineness)
+// Print how well the lazy row cache did, once all the commands have run
+void printRowCache(const System& sys, std::ofstream& out)
+{
+	const RowCache* cache = sys.getRowCache();
+	if (!cache) return;
+
+	long long requests = cache->getHits() + cache->getMisses();
+	out << "\nROW CACHE\n\n"
+		<< std::setprecision(4)
+		<< std::setw(30) << "Rows requested: " << std::setw(14) << requests << "\n"
+		<< std::setw(30) << "Cache hits: " << std::setw(14) << cache->getHits() << "\n"
+		<< std::setw(30) << "Hit rate (%): " << std::setw(14)
+		<< (requests > 0 ? 100.0*cache->getHits()/requests : 0.0) << "\n"
+		<< std::setw(30) << "Rows calculated: " << std::setw(14) << cache->getComputed()
+		<< " of " << sys.getN() << "\n"
+		<< std::setw(30) << "Rows recalculated: " << std::setw(14)
+		<< cache->getMisses() - cache->getComputed() << "\n"
+		<< std::setw(30) << "Peak cache size (MB): " << std::setw(14)
+		<< cache->getPeak()/(1024.0*1024.0) << "\n";
+}
+
+// Print the gradients of the non-zero integrals to file
+void printGradient(const System& sys, std::ofstream& out)
 {
 	int N = sys.getN();
-	
+	if (!sys.hasGradient()) {
+		out << "The gradient of the overlap integrals has not been calculated.\n";
+		return;
+	}
+
+	out << "GRADIENT OF THE NON-ZERO INTEGRALS: " << (N*(N+1))/2 - sys.getZeroes() << "\n\n"
+		<< "Derivatives of each integral with respect to the coordinates of the\n"
+		<< "function in its column; those with respect to the function in its row\n"
+		<< "are their negatives.\n\n";
+
+	out << std::setw(8) << "Row"
+		<< std::setw(8) << "Column"
+		<< std::setw(20) << "Integral"
+		<< std::setw(20) << "d/dx"
+		<< std::setw(20) << "d/dy"
+		<< std::setw(20) << "d/dz\n"
+		<< std::string(96, '.') << "\n";
+
+	// Loop through rows and columns in order, as for the integrals
+	TextWriter text(out);
+	RowReader reader(sys);
+	for (int i = 0; i < N; i++){
+		int count = reader.read(i);
+		const double* grads = sys.getGradients(i);
+		for (int k = 0; k < count; k++){
+			text.putInt(reader.col(k)+1, 8);
+			text.putInt(i+1, 8);
+			text.putDouble(reader.vals[k], 20, 8);
+			for (int d = 0; d < 3; d++) text.putDouble(grads[3*k+d], 20, 8);
+			text.put('\n');
+		}
+	}
+}
+
+// The size of the sparse graph blocks, and the number of them along each side
+static void graphBlocks(int N, int fineness, int& blocksize, int& matrixSize)
+{
 	// Fineness only makes sense if positive
 	if (fineness < 1) {
 		std::cerr << "Invalid choice of fineness - must be > 0.\n";
 		fineness = 1;
 	}
-    int blocksize = (N/fineness > 0 ? N/fineness : 1);
-	int matrixSize = N/blocksize + (N-N/blocksize > 0 ? 1 : 0);
+    blocksize = (N/fineness > 0 ? N/fineness : 1);
+	matrixSize = N/blocksize + (N-N/blocksize > 0 ? 1 : 0);
+}
 
-	// Make a matrix of densities, all entries initialised to zero 
-	std::vector<std::vector<double> > densities(matrixSize, std::vector<double>(matrixSize, 0.0));
-	
-	// Loop through the overlap matrix, summing the blocks
-    int currIndex = 1;
-	int position = 0;
-	int currRow = 0;
-	int currCol = 0;
-	for (int i = 0; i < N; i++){
-		currCol = i/blocksize; // Will give nearest integer below
-		for (int j = 0; j < i+1; j++) {
-			currRow = (j)/blocksize;
-			if (sys.sIndices[position] == currIndex){
-				densities[currRow][currCol] += sys.sInts[position];
-
-				position++;
-				if (position >= sys.sInts.size()) {
-					j = i+1;
-					i = N;
-				}
-			}
-			currIndex++;
-		}
-	}
+// Print the sparse graph densities, summed into the upper triangle
+static void printDensities(std::ofstream& out, std::vector<std::vector<double> >& densities)
+{
+	int matrixSize = densities.size();
 
 	// Print this to file in the format
 	// row    col    density
-	out << std::setprecision(6);
+	TextWriter text(out);
 	for(int i = 0; i < matrixSize; i++) {
 		for (int j = 0; j < matrixSize; j++) {
 			// Symmetrise the matrix (below diagonal will be zero otherwise)
 			if ( i > j ) densities[i][j] = densities[j][i]; 
 
-			out << std::setw(15) << i
-				<< std::setw(15) << j
-				<< std::setw(15) << densities[i][j] << "\n";
+			text.putInt(i, 15);
+			text.putInt(j, 15);
+			text.putDouble(densities[i][j], 15, 6);
+			text.put('\n');
 		}
 	}		
 }
 
-// Print the results of the orthogonalisation procedure to file
-void printOrthog(const System& sys, std::ofstream& out, const Eigen::MatrixXd& f, int orthogType)
+// Print out the sparse graph data
+// This data is used to make a greyscale graph in which
+// the density of the matrix is represented by darkness
+// fineness controls the size of the blocks, where for example
+// 100 would give blocks of size [N/100]
+void printSparseGraph(const System& sys, std::ofstream& out, int fineness)
 {
-	int nfuncs = f.rows();
+	int N = sys.getN();
+	int blocksize, matrixSize;
+	graphBlocks(N, fineness, blocksize, matrixSize);
 
+	// Make a matrix of densities, all entries initialised to zero 
+	std::vector<std::vector<double> > densities(matrixSize, std::vector<double>(matrixSize, 0.0));
+	
+	// Loop through the overlap matrix, summing the blocks
+	RowReader reader(sys);
+	for (int i = 0; i < N; i++){
+		int currCol = i/blocksize; // Will give nearest integer below
+		int count = reader.read(i);
+		for (int k = 0; k < count; k++)
+			densities[reader.col(k)/blocksize][currCol] += reader.vals[k];
+	}
+
+	printDensities(out, densities);
+}
+
+// As above, but summing the blocks of an H-matrix
+void printSparseGraph(const HMatrix& H, std::ofstream& out, int fineness)
+{
+	int blocksize, matrixSize;
+	graphBlocks(H.size(), fineness, blocksize, matrixSize);
+	std::vector<std::vector<double> > densities = H.densities(blocksize, matrixSize);
+	printDensities(out, densities);
+}
+
+// Name of an orthogonalisation type, as numbered for printOrthog
+static std::string orthogName(int orthogType)
+{
 	std::string oType;
 	switch(orthogType){
 	case 1: { oType = "CANONICAL"; break; }
@@ -447,7 +893,20 @@ void printOrthog(const System& sys, std::ofstream& out, const Eigen::MatrixXd& f
 	case 3: { oType = "SYMMETRIC LOWDIN"; break; }
 	default: oType = "UNKNOWN";
 	}
-	out << oType << " ORTHOGONALISATION RESULTS\n\n";
+	return oType;
+}
+
+// Print the results of the orthogonalisation procedure to file
+void printOrthog(const System& sys, std::ofstream& out, const Eigen::MatrixXd& f, int orthogType,
+				 double cutoff)
+{
+	int nfuncs = f.rows();
+	int northog = f.cols(); // Fewer than nfuncs if any were removed
+
+	out << orthogName(orthogType) << " ORTHOGONALISATION RESULTS\n\n";
+	if (cutoff > 0.0)
+		out << nfuncs - northog << " of " << nfuncs << " functions removed, as near-linear"
+			<< " dependencies, with overlap eigenvalues below " << cutoff << "\n\n";
 	
 	// First print out details of the relevant Gaussians
 	out << "BASIS FUNCTIONS\n"
@@ -465,16 +924,358 @@ void printOrthog(const System& sys, std::ofstream& out, const Eigen::MatrixXd& f
 	// in same order as above
 	out << "\n\nFUNCTION SPECIFICATION";
 
+	TextWriter text(out);
+	for (int i = 0; i < northog; i++){
+		text.put("\nFUNCTION ");
+		text.putInt(i+1, 0);
+		text.put(" COEFFICIENTS:\n");
+		for (int j = 0; j < nfuncs; j++){
+			text.putDouble(f(j, i), 0, 4);
+			text.put('\n');
+		}
+	}
+	
+}
+
+// Print the estimated extreme eigenvalues and condition number
+void printSpectrum(const System& sys, std::ofstream& out, int steps, double lmin, double lmax)
+{
+	out << "OVERLAP MATRIX SPECTRUM ESTIMATE\n\n"
+		<< "From " << steps << " Lanczos iterations on the "
+		<< sys.getN() << " x " << sys.getN() << " overlap matrix,\n"
+		<< "with a threshold of " << sys.getThreshold() << "\n\n";
+
+	out << std::setprecision(8)
+		<< std::setw(30) << "Smallest eigenvalue: " << std::setw(16) << lmin << "\n"
+		<< std::setw(30) << "Largest eigenvalue: " << std::setw(16) << lmax << "\n";
+
+	if (lmin > 0)
+		out << std::setw(30) << "Condition number: " << std::setw(16) << lmax/lmin << "\n";
+	else
+		out << "\nThe overlap matrix is not positive definite at this threshold.\n";
+}
+
+// Print the sparsity, zeroes, and non-zero storage of the overlap matrix at
+// each of the sweep thresholds, as counted during calcOverlap
+void printSweep(const System& sys, std::ofstream& out)
+{
+	int N = sys.getN();
+	long long total = ((long long) N*(N+1))/2;
+	const std::vector<double>& thresholds = sys.getSweepThresholds();
+
+	out << "THRESHOLD SWEEP\n\n"
+		<< "For " << N << " basis functions, " << total << " possible unique integrals.\n"
+		<< "Non-zero storage is " << sizeof(double) + sizeof(int)
+		<< " bytes per integral, as stored by System.\n\n";
+
+	out << std::setw(14) << "Threshold"
+		<< std::setw(16) << "Zeroes"
+		<< std::setw(16) << "Non-zero"
+		<< std::setw(14) << "Sparsity (%)"
+		<< std::setw(14) << "Memory (MB)\n"
+		<< std::string(73, '.') << "\n";
+
+	// Thresholds are held in ascending order, but printed loosest first
+	for (int i = thresholds.size() - 1; i >= 0; i--) {
+		long long zeroes = sys.sweepZeroes(i);
+		long long nonzero = total - zeroes;
+		out << std::setprecision(4)
+			<< std::setw(14) << thresholds[i]
+			<< std::setw(16) << zeroes
+			<< std::setw(16) << nonzero
+			<< std::setw(14) << 100.0*zeroes/total
+			<< std::setw(14) << nonzero*(sizeof(double) + sizeof(int))/(1024.0*1024.0) << "\n";
+	}
+
+	// And the histogram itself
+	const std::vector<long long>& counts = sys.getSweepCounts();
+	out << "\nHISTOGRAM OF INTEGRAL MAGNITUDES\n\n"
+		<< std::setw(14) << "At least"
+		<< std::setw(14) << "Below"
+		<< std::setw(16) << "Count\n"
+		<< std::string(44, '.') << "\n";
+	for (int b = counts.size() - 1; b >= 0; b--) {
+		out << std::setw(14);
+		if (b > 0) out << thresholds[b-1]; else out << "0";
+		out << std::setw(14);
+		if (b < thresholds.size()) out << thresholds[b]; else out << "-";
+		out << std::setw(16) << counts[b] << "\n";
+	}
+}
+
+// Print the sampling estimate of the sparsity, with confidence intervals
+void printEstimate(const System& sys, std::ofstream& out, const SparsityEstimate& est)
+{
+	double bytes = sizeof(double) + sizeof(int);
+	double lo = std::max(0.0, est.nonzero - est.nonzeroError);
+	double hi = std::min((double) est.total, est.nonzero + est.nonzeroError);
+
+	out << "SPARSITY ESTIMATE\n\n"
+		<< "For " << sys.getN() << " basis functions, with a threshold of "
+		<< sys.getThreshold() << "\n"
+		<< "Cutoff radius: " << est.cutoff << ", in " << est.cells << " occupied cells\n"
+		<< "Pairs in the same or neighbouring cells: " << est.nearPairs
+		<< " out of " << est.total << " possible unique integrals\n";
+	if (est.exact)
+		out << "All " << est.samples << " of these were evaluated, so the results are exact.\n\n";
+	else
+		out << est.samples << " of these were sampled; intervals are at "
+			<< 100.0*est.confidence << " percent confidence.\n\n";
+
+	out << std::setprecision(6) << std::fixed;
+	out << std::setw(24) << " "
+		<< std::setw(18) << "Estimate"
+		<< std::setw(18) << "Lower"
+		<< std::setw(18) << "Upper\n"
+		<< std::string(78, '.') << "\n";
+	out << std::setw(24) << "Sparsity (%)"
+		<< std::setw(18) << est.sparsity()
+		<< std::setw(18) << 100.0*(est.total - hi)/est.total
+		<< std::setw(18) << 100.0*(est.total - lo)/est.total << "\n";
+	out << std::setprecision(0)
+		<< std::setw(24) << "Zeroes"
+		<< std::setw(18) << est.zeroes()
+		<< std::setw(18) << est.total - hi
+		<< std::setw(18) << est.total - lo << "\n";
+	out << std::setw(24) << "Non-zero integrals"
+		<< std::setw(18) << est.nonzero
+		<< std::setw(18) << lo
+		<< std::setw(18) << hi << "\n";
+	out << std::setprecision(3)
+		<< std::setw(24) << "Storage (MB)"
+		<< std::setw(18) << est.nonzero*bytes/(1024.0*1024.0)
+		<< std::setw(18) << lo*bytes/(1024.0*1024.0)
+		<< std::setw(18) << hi*bytes/(1024.0*1024.0) << "\n";
+	out.unsetf(std::ios::fixed);
+}
+
+// Print the plan. The format flags of out are restored afterwards, as more
+// is printed to the main output file after it.
+void printPlan(std::ofstream& out, const Plan& plan, bool timings)
+{
+	const char* const storageNames[3] = { "plain", "compressed", "lazy" };
+	std::ios::fmtflags flags = out.flags();
+	std::streamsize precision = out.precision();
+
+	out << "\nEXECUTION PLAN\n\n";
+	if (!plan.enabled) {
+		out << "The planner is off, so everything is as given by the input.\n\n";
+		return;
+	}
+
+	out << std::setprecision(4)
+		<< "For " << plan.N << " basis functions, with " << plan.exponents << " distinct exponents,\n"
+		<< "in a box of " << plan.extent[0] << " x " << plan.extent[1] << " x " << plan.extent[2]
+		<< ", and a cutoff radius of " << plan.cutoff << ",\n"
+		<< std::setprecision(0) << std::fixed
+		<< plan.nonzero << " +/- " << plan.nonzeroError << " of the " << plan.total
+		<< " unique integrals are estimated to be non-zero,\nand " << plan.nearPairs
+		<< " pairs are near enough to each other to be looked at.\n";
+	out.flags(flags);
+	if (timings) {
+		out << std::setprecision(3)
+			<< "One integral takes " << 1e9*plan.pairSeconds << " ns";
+		if (plan.flops > 0.0) out << ", and a dense matrix product runs at "
+								  << 1e-9*plan.flops << " GFLOP/s";
+		out << ",\nwith " << plan.threads << (plan.threads == 1 ? " thread" : " threads") << " and "
+			<< plan.memory/(1024.0*1024.0*1024.0) << " GB of memory.\n";
+	}
+	out << "\n";
+
+	out << std::left
+		<< std::setw(20) << "Storage" << std::setw(14) << storageNames[plan.storage]
+		<< plan.storageReason << "\n"
+		<< std::setw(20) << "Screening" << std::setw(14) << (plan.screen ? "spatial" : "every pair")
+		<< plan.screenReason << "\n"
+		<< std::setw(20) << "Worker processes" << std::setw(14) << plan.shards
+		<< plan.threadReason << "\n"
+		<< std::setw(20) << "Eigensolver" << std::setw(14)
+		<< (plan.solver == PARALLEL_EIGEN ? "parallel" : "serial") << plan.solverReason << "\n"
+		<< std::setw(20) << "Canonical cutoff" << std::setw(14) << (plan.sparse ? "sparse" : "dense")
+		<< plan.sparseReason << "\n\n";
+	out.flags(flags);
+
+	out << std::setprecision(3)
+		<< "Predicted: the overlap matrix takes " << plan.seconds << " s for " << plan.pairs
+		<< " integrals, stored in " << plan.bytes/(1024.0*1024.0) << " MB";
+	if (plan.denseBytes > 0.0)
+		out << ",\nand the dense orthogonalisations " << plan.denseBytes/(1024.0*1024.0) << " MB";
+	if (plan.denseSeconds > 0.0)
+		out << ", the largest taking " << plan.denseSeconds << " s to diagonalise";
+	out << ".\n\n";
+
+	out.flags(flags);
+	out.precision(precision);
+}
+
+// Decode the windows given as lists by getNextCmd, where params holds the
+// size of each window followed by its (1-based) function numbers. Functions
+// not in the System are left out, with a warning, as are empty windows.
+std::vector<Window> listWindows(const System& sys, const std::vector<double>& params)
+{
+	std::vector<Window> windows;
+	int p = 0;
+	while (p < params.size()) {
+		int size = (int) params[p++];
+		Window w;
+		w.centre = -1;
+		for (int k = 0; k < size && p < params.size(); k++, p++){
+			int i = (int) params[p] - 1;
+			if (i >= 0 && i < sys.getN()) w.indices.push_back(i);
+			else std::cerr << "Function " << i+1 << " in window " << windows.size()+1
+						   << " does not exist, so is left out.\n";
+		}
+		std::sort(w.indices.begin(), w.indices.end());
+		w.indices.erase(std::unique(w.indices.begin(), w.indices.end()), w.indices.end());
+		if (w.indices.size() > 0) windows.push_back(w);
+	}
+	return windows;
+}
+
+// Print the heading of the window orthogonalisation results
+void printWindowsHeader(std::ofstream& out, int orthogType, int nwindows, double radius, int stride)
+{
+	out << orthogName(orthogType) << " ORTHOGONALISATION OF LOCAL WINDOWS\n\n"
+		<< nwindows << " windows, ";
+	if (stride > 0)
+		out << "of the functions within a radius of " << radius
+			<< " of every " << (stride > 1 ? std::to_string(stride) + " functions" : "function") << "\n";
+	else
+		out << "given as lists of functions\n";
+	out << "An index of where each window starts in this file is given at the end.\n\n";
+}
+
+// Print the results for the kth window (counting from 1)
+void printWindow(std::ofstream& out, int k, const Window& w,
+				 const Eigen::MatrixXd& f, bool ok)
+{
+	int nfuncs = w.indices.size();
+
+	out << "WINDOW " << k << ": " << nfuncs << " FUNCTIONS";
+	if (w.centre >= 0) out << ", CENTRED ON FUNCTION " << w.centre+1;
+	out << "\nFUNCTIONS:\n";
+	for (int i = 0; i < nfuncs; i++)
+		out << w.indices[i]+1 << (i % 10 == 9 || i == nfuncs-1 ? "\n" : " ");
+
+	if (!ok) {
+		out << "Could not be orthogonalised (overlap matrix not positive definite).\n\n";
+		return;
+	}
+
+	// Coefficients of the orthonormalised functions, in terms
+	// of the functions in the window, in the order above
+	out << std::setprecision(4);
 	for (int i = 0; i < nfuncs; i++){
-		out << "\nFUNCTION " << i+1 << " COEFFICIENTS:\n";
+		out << "FUNCTION " << i+1 << " COEFFICIENTS:\n";
 		for (int j = 0; j < nfuncs; j++)
 			out << f(j, i) << "\n";
 	}
-	
+	out << "\n";
+}
+
+// Print the index of the windows: their size, centre, and the
+// offset in bytes of their results from the start of the file
+void printWindowsIndex(std::ofstream& out, const std::vector<Window>& windows,
+					   const std::vector<long long>& offsets)
+{
+	out << "INDEX\n"
+		<< std::setw(10) << "Window"
+		<< std::setw(12) << "Functions"
+		<< std::setw(10) << "Centre"
+		<< std::setw(16) << "Offset\n"
+		<< std::string(48, '.') << "\n";
+	for (int k = 0; k < windows.size(); k++){
+		out << std::setw(10) << k+1
+			<< std::setw(12) << windows[k].indices.size()
+			<< std::setw(10);
+		if (windows[k].centre >= 0) out << windows[k].centre+1; else out << "-";
+		out << std::setw(16) << offsets[k] << "\n";
+	}
+}
+
+// Print the similarity of each candidate to the reference. A candidate with no
+// Gaussians (e.g. one whose input file could not be read) is flagged as such.
+void printComparison(const System& sys, std::ofstream& out, double selfOverlap,
+					 const std::vector<std::string>& names, const std::vector<Similarity>& results)
+{
+	out << "OVERLAP SIMILARITY\n\n"
+		<< "Reference of " << sys.getN() << " basis functions, with S_AA = "
+		<< std::setprecision(8) << selfOverlap << ",\ncompared with " << results.size()
+		<< " systems at a threshold of " << std::setprecision(3) << sys.getThreshold() << "\n\n"
+		<< std::setw(8) << "System"
+		<< std::setw(10) << "N"
+		<< std::setw(18) << "S_AB"
+		<< std::setw(18) << "S_BB"
+		<< std::setw(14) << "Tanimoto"
+		<< std::setw(14) << "Nonzero"
+		<< "   File\n"
+		<< std::string(100, '.') << "\n";
+	for (int k = 0; k < results.size(); k++){
+		const Similarity& sim = results[k];
+		out << std::setw(8) << k+1 << std::setw(10) << sim.N;
+		if (sim.N == 0) out << std::setw(74) << "(no basis functions)";
+		else {
+			out << std::setprecision(8)
+				<< std::setw(18) << sim.cross
+				<< std::setw(18) << sim.self
+				<< std::setprecision(6)
+				<< std::setw(14) << sim.tanimoto
+				<< std::setw(14) << sim.nonzero;
+		}
+		out << "   " << names[k] << "\n";
+	}
 }
 
+// Print the structure, storage, and accuracy of an H-matrix. The relative
+// error of a product with a random vector is checked on a sample of rows,
+// against the exact integrals.
+void printHMatrix(const System& sys, std::ofstream& out, const HMatrix& H)
+{
+	int N = H.size();
+	double full = 0.5*N*(N+1.0); // Unique integrals
+	double stored = H.storage();
 
+	out << "H-MATRIX OF THE OVERLAP MATRIX\n\n"
+		<< "For " << N << " basis functions, with an ACA tolerance of " << H.getTolerance()
+		<< "\nand at most " << H.getLeafSize() << " functions in each of "
+		<< H.getNClusters() << " clusters\n\n";
 
+	out << std::setw(30) << "Dense blocks: " << std::setw(14) << H.getNDense() << "\n"
+		<< std::setw(30) << "Low-rank blocks: " << std::setw(14) << H.getNLowRank() << "\n"
+		<< std::setw(30) << "Largest rank: " << std::setw(14) << H.getMaxRank() << "\n"
+		<< std::setprecision(4)
+		<< std::setw(30) << "Mean rank: " << std::setw(14) << H.getMeanRank() << "\n\n";
 
-											   
-							
+	out << std::setw(30) << "Values stored: " << std::setw(14) << (long long) stored << "\n"
+		<< std::setw(30) << "Memory (MB): " << std::setw(14)
+		<< stored*sizeof(double)/(1024.0*1024.0) << "\n"
+		<< std::setw(30) << "Dense triangle (MB): " << std::setw(14)
+		<< full*sizeof(double)/(1024.0*1024.0) << "\n"
+		<< std::setw(30) << "Compression ratio: " << std::setw(14) << full/stored << "\n";
+	if (sys.hasOverlap()) {
+		double sparse = sys.storage();
+		out << std::setw(30) << "Sparse storage (MB): " << std::setw(14)
+			<< sparse/(1024.0*1024.0) << "\n"
+			<< std::setw(30) << "Ratio to sparse storage: " << std::setw(14)
+			<< sparse/(stored*sizeof(double)) << "\n";
+	}
+
+	// Check a product against the exact integrals, on at most 100 rows
+	std::mt19937 generator(12345);
+	std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+	Eigen::VectorXd x(N), y;
+	for (int i = 0; i < N; i++) x(i) = uniform(generator);
+	H.multiply(x, y);
+
+	double err2 = 0.0, norm2 = 0.0;
+	int rows = std::min(N, 100);
+	for (int r = 0; r < rows; r++){
+		int i = (int) ((long long) r*N/rows);
+		double exact = 0.0;
+		for (int j = 0; j < N; j++) exact += sys.getGaussian(i).overlap(sys.getGaussian(j))*x(j);
+		err2 += (y(i) - exact)*(y(i) - exact);
+		norm2 += exact*exact;
+	}
+	out << "\nRelative error of a product with a random vector, over "
+		<< rows << " rows: " << (norm2 > 0 ? sqrt(err2/norm2) : 0.0) << "\n";
+}
@@ -8,6 +8,16 @@
  * DATE            AUTHOR            CHANGES 
  * =====================================================================================
  * 19/12/15        Robert Shaw       Original code.
+ * 18/10/26        agent             Condition number command.
+ * 18/10/26        agent             Threshold sweep command.
+ * 18/10/26        agent             Sampling sparsity estimate command.
+ * 18/10/26        agent             Local window orthogonalisation command.
+ * 18/10/26        agent             H-matrix command and sparse graph.
+ * 18/10/26        agent             Overlap gradient command.
+ * 18/10/26        agent             Lazy row cache statistics.
+ * 18/10/26        agent             Partial-spectrum canonical orthogonalisation.
+ * 19/10/26        agent             Execution plan.
+ * 19/10/26        agent             Timings of the plan only printed on request.
  *
  **********************************************************************************************/
 
@@ -21,15 +31,28 @@
 
 class System; // Forward declaration
 class Gaussian;
+struct SparsityEstimate;
+struct Window;
+class HMatrix;
+struct Similarity;
+struct PlanPins;
+struct Plan;
 
 // Returns the next command
 std::vector<int> getNextCmd(std::ifstream& in, int lastCmd_);
+// As above, also returning any real-valued parameters (e.g. thresholds)
+std::vector<int> getNextCmd(std::ifstream& in, int lastCmd_, std::vector<double>& params);
+// As above, also returning any file names (e.g. of systems to compare with)
+std::vector<int> getNextCmd(std::ifstream& in, int lastCmd_, std::vector<double>& params,
+							std::vector<std::string>& names);
 
 // Identify a token
 int findToken(std::string t_);
 
 // Make the system from the geometry/basis specification
 System makeSystem(std::ifstream& in);
+// As above, also returning which of the options the planner may choose were given
+System makeSystem(std::ifstream& in, PlanPins& pins);
 
 // Add all basis functions of a particular atom type
 void addAtomType(std::ifstream& in, System& sys, std::string atomtype_,
@@ -41,13 +64,57 @@ void printSystem(const System& sys, std::ofstream& out, bool printBasis = false)
 // Print the non-zero overlap integrals, and their indices, to file
 void printIntegrals(const System& sys, std::ofstream& out);
 
+// Print the hits, misses, and rows calculated by the lazy row cache, if any
+void printRowCache(const System& sys, std::ofstream& out);
+
+// Print the gradients of the non-zero overlap integrals to file
+void printGradient(const System& sys, std::ofstream& out);
+
 // Print the data for a sparse-graph
 // fineness controls the size of `block' that the matrix is split into
 // for example, a fineness of 100 will give block sizes of [N/100]
 void printSparseGraph(const System& sys, std::ofstream& out, int fineness);
+// As above, from an H-matrix, so that the sums include all the integrals
+// (to within its tolerance) rather than only those above the threshold
+void printSparseGraph(const HMatrix& H, std::ofstream& out, int fineness);
+
+// Print the structure, compression, and accuracy of an H-matrix
+void printHMatrix(const System& sys, std::ofstream& out, const HMatrix& H);
+
+// Print the orthogonalisation results, and if cutoff is positive, how many
+// functions were removed as near-linear dependencies below it
+void printOrthog(const System& sys, std::ofstream& out, const Eigen::MatrixXd& f, int orthogType,
+				 double cutoff = 0.0);
+
+// Print the Lanczos estimate of the extreme eigenvalues, and hence
+// the condition number, of the overlap matrix
+void printSpectrum(const System& sys, std::ofstream& out, int steps, double lmin, double lmax);
+
+// Print the results of a threshold sweep
+void printSweep(const System& sys, std::ofstream& out);
+
+// Print a sampling estimate of the sparsity
+void printEstimate(const System& sys, std::ofstream& out, const SparsityEstimate& est);
+
+// Make the windows given as lists of functions, as returned in params by getNextCmd
+std::vector<Window> listWindows(const System& sys, const std::vector<double>& params);
+
+// Print the local window orthogonalisation results; the header, then each
+// window in turn, and finally the index of where each window was printed
+void printWindowsHeader(std::ofstream& out, int orthogType, int nwindows, double radius, int stride);
+void printWindow(std::ofstream& out, int k, const Window& w,
+				 const Eigen::MatrixXd& f, bool ok);
+void printWindowsIndex(std::ofstream& out, const std::vector<Window>& windows,
+					   const std::vector<long long>& offsets);
+
+// Print the similarity of each system compared with the reference, sys, where
+// names are the input files they were made from, and selfOverlap is that of sys
+void printComparison(const System& sys, std::ofstream& out, double selfOverlap,
+					 const std::vector<std::string>& names, const std::vector<Similarity>& results);
 
-// Print the orthogonalisation results
-void printOrthog(const System& sys, std::ofstream& out, const Eigen::MatrixXd& f, int orthogType);
+// Print the choices of the planner, why they were made, and what they are predicted
+// to cost, and if timings, the measurements of the machine they were made from
+void printPlan(std::ofstream& out, const Plan& plan, bool timings);
 
 // Print the details of a gaussian basis function
 void printGaussian(const Gaussian& g, std::ofstream& out);
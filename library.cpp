@@ -0,0 +1,42 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement the in-memory interface to the library
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ *
+ ***************************************************************************************/
+
+#include "library.hpp"
+#include "gaussian.hpp"
+
+System makeSystem(int n, const double* coords, const double* zetas, double threshold)
+{
+	System sys(threshold);
+	for (int i = 0; i < n; i++)
+		sys.addGaussian(Gaussian(zetas[i], coords[3*i], coords[3*i+1], coords[3*i+2]));
+	return sys;
+}
+
+bool viewOverlap(const System& sys, OverlapView& view)
+{
+	if (!sys.hasOverlap() || sys.getCompressed()) return false;
+
+	view.N = sys.getN();
+	view.nonzero = sys.sInts.size();
+	view.rowStart = sys.sRowStart.data();
+	view.indices = sys.sIndices.data();
+	view.values = sys.sInts.data();
+	view.gradients = (sys.hasGradient() ? sys.sGrads.data() : 0);
+	return true;
+}
+
+MatrixView viewMatrix(const Eigen::MatrixXd& f)
+{
+	MatrixView view;
+	view.rows = f.rows();
+	view.cols = f.cols();
+	view.data = f.data();
+	return view;
+}
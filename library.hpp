@@ -0,0 +1,72 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To provide an in-memory interface to the library, so that other programs
+ *          can build a System from their own arrays, calculate its overlap, and read
+ *          the results straight from the System, without going through input and
+ *          output files. The rest of the interface is that of System (calcOverlap,
+ *          setGradient, setCell, addGaussian and rollback to grow a System after its
+ *          overlap is calculated, ...), orthogonalise, OverlapComparer (compare.hpp),
+ *          to compare systems made this way with each other, and makePlan (planner.hpp),
+ *          to choose how a system is calculated.
+ *
+ * CONTAINS:
+ *          makeSystem(n, coords, zetas, threshold) - a System of n gaussians
+ *          struct OverlapView - the stored non-zero integrals of a System, in
+ *                               compressed sparse row form
+ *          viewOverlap(sys, view) - point a view at the integrals of sys
+ *          struct MatrixView - a column-major dense matrix, e.g. the coefficients
+ *                              returned by orthogonalise
+ *          viewMatrix(f) - point a view at f
+ *
+ *          Views point at the storage of what they view, so copy nothing, and are
+ *          only valid while it is unchanged (e.g. until calcOverlap is called again,
+ *          or a Gaussian is added to or removed from the System).
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 18/10/26     agent            Original code.
+ * 18/10/26     agent            Comparison of systems.
+ * 19/10/26     agent            Execution planner.
+ * 19/10/26     agent            Growing a System after calcOverlap.
+ *
+ ************************************************************************************/
+
+#ifndef LIBRARYHEADERDEF
+#define LIBRARYHEADERDEF
+
+#include "system.hpp"
+#include <Eigen/Dense>
+
+// A System of n gaussians, the ith with exponent zetas[i], placed at
+// (coords[3i], coords[3i+1], coords[3i+2])
+System makeSystem(int n, const double* coords, const double* zetas, double threshold = 1e-4);
+
+// The non-zero integrals of the lower triangle of the overlap matrix. Row i has
+// rowStart[i+1] - rowStart[i] integrals, starting at values[rowStart[i]], with
+// columns j in ascending order, given by packed indices 1 + j + i(i+1)/2.
+struct OverlapView
+{
+	int N; // Number of rows
+	long long nonzero; // Number of integrals
+	const int* rowStart; // N+1 row starts
+	const int* indices; // Packed index of each integral
+	const double* values; // The integrals
+	const double* gradients; // Their gradients, three each, or null if not calculated
+};
+
+// Point view at the integrals of sys. Returns false if they have not been
+// calculated, or are compressed, in which case they can only be read a row
+// at a time through a RowReader (see storage.hpp).
+bool viewOverlap(const System& sys, OverlapView& view);
+
+// A dense matrix, stored column by column; for the result of orthogonalise,
+// column i holds the coefficients of the ith orthogonal function
+struct MatrixView
+{
+	int rows, cols;
+	const double* data; // Element (i, j) is data[i + j*rows]
+};
+
+MatrixView viewMatrix(const Eigen::MatrixXd& f);
+
+#endif
@@ -5,16 +5,60 @@
  * DATE            AUTHOR             CHANGES
  * ==============================================================================
  * 19/12/15        Robert Shaw        Original code.
+ * 18/10/26        agent              Commands run concurrently as a task graph;
+ *                                    one output file per orthogonalisation.
+ * 18/10/26        agent              Local window orthogonalisation.
+ * 18/10/26        agent              H-matrix command.
+ * 18/10/26        agent              Sparse graph pyramid.
+ * 18/10/26        agent              Overlap gradient.
+ * 18/10/26        agent              Periodic systems.
+ * 18/10/26        agent              Lazy row cache statistics.
+ * 18/10/26        agent              Partial-spectrum canonical orthogonalisation.
+ * 18/10/26        agent              Choice of eigensolver.
+ * 18/10/26        agent              Comparison with other systems.
+ * 19/10/26        agent              Execution planner.
+ * 19/10/26        agent              Plan only printed if asked for; windows planned for.
+ * 19/10/26        agent              Threads of the parallel eigensolver shared between commands.
+ * 19/10/26        agent              Parallel eigensolver only when asked for; plan always printed.
+ * 19/10/26        agent              Condition number estimate shares the threads too.
+ * 19/10/26        agent              As do comparisons.
  *
  ****************************************************************************************/
 
 #include "system.hpp"
 #include "io.hpp"
 #include "orthogonalise.hpp"
+#include "tasks.hpp"
+#include "products.hpp"
+#include "estimate.hpp"
+#include "windows.hpp"
+#include "hmatrix.hpp"
+#include "pyramid.hpp"
+#include "compare.hpp"
+#include "planner.hpp"
 #include <iostream>
 #include <fstream>
+#include <map>
+#include <memory>
+#include <algorithm>
 #include <Eigen/Dense>
 
+// Orthogonalisation methods and output file names, indexed by
+// the orthogonalisation type used in printOrthog
+const int ORTHOG_METHODS[4] = { 0, CANONICAL, GRAM_SCHMIDT, SYM_LOWDIN };
+const char* const ORTHOG_NAMES[4] = { "", "canonical", "gramschmidt", "symlowdin" };
+
+// Return the name of the output file prefix.ext, or if this has already
+// been used by an earlier command, prefix.ext with a count before the
+// extension (e.g. thc.2.sparse), so that no two commands share a file
+std::string outputName(const std::string& prefix, const std::string& ext,
+					   std::map<std::string, int>& usedNames)
+{
+	int count = ++usedNames[ext];
+	if (count == 1) return prefix + "." + ext;
+	return prefix + "." + std::to_string(count) + "." + ext;
+}
+
 int main(int argc, char* argv[])
 {
 	int program = 0;
@@ -40,71 +84,294 @@ int main(int argc, char* argv[])
 		} else {
 			
 			// Make the system
-			System sys = makeSystem(input);
+			PlanPins pins;
+			System sys = makeSystem(input, pins);
+
+			// Read in all the optional commands, stopping at the
+			// end of the list or at the first erroneous command
+			int lastcmd = 0;
+			int flag = 1;
+			std::vector<int> currcmd;
+			std::vector<double> params;
+			std::vector<std::string> names;
+			std::vector<std::vector<int> > cmds;
+			std::vector<double> sweep;
+			std::vector<std::vector<double> > cmdParams; // Real parameters of each command
+			std::vector<std::vector<std::string> > cmdNames; // File names given to each command
+			bool needOverlap = true; // Unless only estimates, H-matrices, or comparisons are wanted
+			while(flag > 0){
+				currcmd = getNextCmd(input, lastcmd, params, names);
+				if (currcmd[0] > 0) {
+					cmds.push_back(currcmd);
+					// All sweep thresholds are counted in the one pass
+					if (currcmd[0] == 7) sweep.insert(sweep.end(), params.begin(), params.end());
+					// and the gradient is calculated with the integrals
+					if (currcmd[0] == 12) sys.setGradient(true);
+					cmdParams.push_back(params);
+					cmdNames.push_back(names);
+				} else {
+					if (currcmd[0] == -1) program = -1;
+					flag = 0;
+				}
+				lastcmd++;
+			}
+
+			// Estimates are done to judge whether calculating the overlap is feasible,
+			// and H-matrices to avoid calculating it, while comparisons only need the
+			// totals of the screened cross-overlaps, so if nothing else is wanted, it
+			// is not calculated at all
+			if (cmds.size() > 0) {
+				needOverlap = false;
+				bool direct = false; // Whether any command calculates integrals itself
+				for (int c = 0; c < cmds.size(); c++){
+					if (cmds[c][0] != 8 && cmds[c][0] != 10 && cmds[c][0] != 13) needOverlap = true;
+					else direct = true;
+				}
+				// which are not summed over lattice images
+				if (direct && sys.isPeriodic())
+					std::cerr << "Sparsity estimates, H-matrices, and comparisons treat a "
+							  << "periodic system as an isolated cluster.\n";
+			}
 
-			// Calculate the overlap integrals
-			sys.calcOverlap();
+			// What the commands need decides the plan, e.g. the memory left over for the
+			// integrals is what the largest dense orthogonalisation does not take. The
+			// local windows are made here, so that their sizes are known to the plan.
+			Workload work;
+			work.overlap = needOverlap;
+			work.gradient = false;
+			work.sweep = (sweep.size() > 0);
+			work.dense = work.partial = work.cholesky = work.window = 0;
+			std::vector<std::shared_ptr<std::vector<Window> > > cmdWindows(cmds.size());
+			for (int c = 0; c < cmds.size(); c++){
+				int n = (cmds[c][0] >= 3 && cmds[c][0] <= 5 ? cmds[c][1] : 0);
+				if (n <= 0 || n > sys.getN()) n = sys.getN();
+				if (cmds[c][0] == 3 && cmdParams[c].size() > 0) work.partial = std::max(work.partial, n);
+				else if (cmds[c][0] == 3 || cmds[c][0] == 5) work.dense = std::max(work.dense, n);
+				else if (cmds[c][0] == 4) work.cholesky = std::max(work.cholesky, n);
+				else if (cmds[c][0] == 12) work.gradient = true;
+				else if (cmds[c][0] == 9) {
+					int stride = cmds[c][2];
+					double radius = (stride > 0 ? cmdParams[c][0] : 0.0);
+					cmdWindows[c] = std::make_shared<std::vector<Window> >(
+						stride > 0 ? radiusWindows(sys, radius, stride) : listWindows(sys, cmdParams[c]));
+					for (int w = 0; w < cmdWindows[c]->size(); w++)
+						work.window = std::max(work.window, (int) (*cmdWindows[c])[w].indices.size());
+				}
+			}
+
+			// Plan, then calculate the overlap integrals, and the sweep histogram if needed
+			if (sweep.size() > 0) sys.setSweep(sweep);
+			Plan plan = makePlan(sys, pins, work);
+			applyPlan(sys, plan);
+			if (needOverlap) sys.calcOverlap();
 
 			// Open main output file and print system details
 			std::ofstream output(ofname + ".out");
+			printPlan(output, plan, pins.print);
 			printSystem(sys, output, true);
 
-			// Do all the optional commands
-			int lastcmd = 0;
-			int flag = 1;
-			int orthog = 0;
-			std::vector<int> currcmd;
-			Eigen::MatrixXd f;
-			while(flag > 0){
-				currcmd = getNextCmd(input, lastcmd);
+			// Turn the commands into a task graph. The commands only read
+			// the overlap matrix, so are independent of each other; the
+			// writing of orthogonalisation results depends only on the
+			// orthogonalisation itself, and is done on separate I/O threads
+			// so that it overlaps with any remaining computation.
+			ThreadPool computePool(plan.threads);
+			ThreadPool ioPool(2);
+
+			// The parallel eigensolver, the products of the condition number estimate,
+			// and the batched comparisons run on threads of their own, while their task
+			// holds a worker of computePool, so the workers are shared between the
+			// commands that start threads, rather than each taking one per core
+			int threadedCmds = 0;
+			for (int c = 0; c < cmds.size(); c++)
+				if (cmds[c][0] == 3 || cmds[c][0] == 5 || cmds[c][0] == 6 || cmds[c][0] == 13) threadedCmds++;
+			int cmdThreads = std::max(1, plan.threads/std::max(1, std::min(threadedCmds, plan.threads)));
+			TaskGraph graph;
+			std::map<std::string, int> usedNames;
+			for (int c = 0; c < cmds.size(); c++){
+				currcmd = cmds[c];
 				switch(currcmd[0]){
 				case 1: { // Print the overlap integrals
-					std::ofstream intout(ofname + ".ints");
-					printIntegrals(sys, intout);
-					intout.close();
+					std::string fname = outputName(ofname, "ints", usedNames);
+					graph.addTask([&sys, fname]{
+							std::ofstream intout(fname);
+							printIntegrals(sys, intout);
+						}, ioPool);
+					break;
+				}
+				case 12: { // Print the gradient of the overlap integrals
+					std::string fname = outputName(ofname, "grad", usedNames);
+					graph.addTask([&sys, fname]{
+							std::ofstream gradout(fname);
+							printGradient(sys, gradout);
+						}, ioPool);
 					break;
 				}
 				case 2: { // Print the sparse graph data
-					std::ofstream sparseout(ofname + ".sparse");
-					printSparseGraph(sys, sparseout, currcmd[1]);
-					sparseout.close();
+					std::string fname = outputName(ofname, "sparse", usedNames);
+					int fineness = currcmd[1];
+					graph.addTask([&sys, fname, fineness]{
+							std::ofstream sparseout(fname);
+							printSparseGraph(sys, sparseout, fineness);
+						}, computePool);
 					break;
 				}
-				case 3: { // Canonical orthogonalisation
-					f = orthogonalise(sys, currcmd[1], CANONICAL);
-					orthog = 1;
+				case 11: { // Write the sparse graph pyramid
+					std::string dname = outputName(ofname, "pyramid", usedNames);
+					int fineness = currcmd[1];
+					int tileSize = currcmd[2];
+					graph.addTask([&sys, dname, fineness, tileSize]{
+							writePyramid(sys, dname, fineness, tileSize);
+						}, computePool);
 					break;
 				}
-				case 4: { // Gram-Schmidt orthogonalisation
-					f = orthogonalise(sys, currcmd[1], GRAM_SCHMIDT);
-					orthog = 2;
+				case 6: { // Estimate the extreme eigenvalues and condition number
+					std::string fname = outputName(ofname, "cond", usedNames);
+					int steps = currcmd[1];
+					graph.addTask([&sys, fname, steps, cmdThreads]{
+							OverlapOperator op(sys, cmdThreads);
+							double lmin, lmax;
+							int taken = estimateSpectrum(op, steps, lmin, lmax);
+							std::ofstream condout(fname);
+							printSpectrum(sys, condout, taken, lmin, lmax);
+						}, computePool);
 					break;
 				}
-				case 5: { // Symmetric Lowdin orthogonalisation
-					f = orthogonalise(sys, currcmd[1], SYM_LOWDIN); 
-					orthog = 3;
+				case 7: { // Print the threshold sweep
+					std::string fname = outputName(ofname, "sweep", usedNames);
+					graph.addTask([&sys, fname]{
+							std::ofstream sweepout(fname);
+							printSweep(sys, sweepout);
+						}, ioPool);
 					break;
 				}
-				case -1: { // Error
-					output << "\nErroneous command given.\n";
-					flag = 0;
-					program = -1;
+				case 8: { // Estimate the sparsity by sampling
+					std::string fname = outputName(ofname, "estimate", usedNames);
+					int samples = currcmd[1];
+					double confidence = cmdParams[c][0];
+					graph.addTask([&sys, fname, samples, confidence]{
+							SparsityEstimate est = estimateSparsity(sys, samples, confidence);
+							std::ofstream estout(fname);
+							printEstimate(sys, estout, est);
+						}, computePool);
 					break;
 				}
-				default: { // No more commands
-					output << "\nProgram finished.\n";
-					flag = 0;
+				case 10: { // H-matrix, and its sparse graph if wanted
+					std::string fname = outputName(ofname, "hmatrix", usedNames);
+					std::string gname = (currcmd[1] > 0 ? outputName(ofname, "hmatrix.sparse", usedNames) : "");
+					int fineness = currcmd[1];
+					int leafSize = currcmd[2];
+					double tolerance = cmdParams[c][0];
+					graph.addTask([&sys, fname, gname, fineness, leafSize, tolerance]{
+							HMatrix H(sys, tolerance, leafSize);
+							std::ofstream hout(fname);
+							printHMatrix(sys, hout, H);
+							if (fineness > 0) {
+								std::ofstream sparseout(gname);
+								printSparseGraph(H, sparseout, fineness);
+							}
+						}, computePool);
+					break;
 				}
+				case 13: { // Compare with other systems
+					// Every candidate is read in first, then compared with the one
+					// comparer, so that the reference is only indexed once
+					std::string fname = outputName(ofname, "compare", usedNames);
+					std::vector<std::string> files = cmdNames[c];
+					graph.addTask([&sys, fname, files, cmdThreads]{
+							std::vector<System> candidates;
+							candidates.reserve(files.size());
+							for (int k = 0; k < files.size(); k++){
+								std::ifstream candin(files[k]);
+								if (candin.is_open()) candidates.push_back(makeSystem(candin));
+								else {
+									std::cerr << "Failed to open " << files[k] << " to compare with.\n";
+									candidates.push_back(System(sys.getThreshold()));
+								}
+							}
+							OverlapComparer comparer(sys, sys.getThreshold());
+							std::vector<Similarity> results;
+							comparer.compareAll(candidates, results, cmdThreads);
+							std::ofstream compout(fname);
+							printComparison(sys, compout, comparer.getSelfOverlap(), files, results);
+						}, computePool);
+					break;
 				}
-				lastcmd++;
-			}
+				case 9: { // Orthogonalise local windows
+					// The windows are split into chunks, orthogonalised concurrently,
+					// and written in order to the one file, each chunk's results being
+					// freed as soon as they are written
+					int orthog = currcmd[1];
+					int stride = currcmd[2];
+					double radius = (stride > 0 ? cmdParams[c][0] : 0.0);
+					std::shared_ptr<std::vector<Window> > windows = cmdWindows[c];
+					std::string fname = outputName(ofname, std::string(ORTHOG_NAMES[orthog]) + ".windows",
+												   usedNames);
+					std::shared_ptr<std::ofstream> winout = std::make_shared<std::ofstream>();
+					std::shared_ptr<std::vector<long long> > offsets =
+						std::make_shared<std::vector<long long> >(windows->size());
+
+					int last = graph.addTask([winout, fname, windows, orthog, radius, stride]{
+							winout->open(fname);
+							printWindowsHeader(*winout, orthog, windows->size(), radius, stride);
+						}, ioPool);
 
-			// Print orthogonalisation data if needed
-			if (orthog > 0) {
-				std::ofstream orthogout(ofname + ".orthog");
-			    printOrthog(sys, orthogout, f, orthog);
-				orthogout.close();
+					int nwindows = windows->size();
+					int chunk = std::max(1, nwindows/(8*computePool.getNThreads()));
+					for (int first = 0; first < nwindows; first += chunk){
+						int count = std::min(chunk, nwindows - first);
+						std::shared_ptr<std::vector<Eigen::MatrixXd> > fs =
+							std::make_shared<std::vector<Eigen::MatrixXd> >(count);
+						std::shared_ptr<std::vector<char> > ok = std::make_shared<std::vector<char> >(count);
+						std::vector<int> deps(1, last);
+						deps.push_back(graph.addTask([&sys, windows, fs, ok, first, count, orthog]{
+								for (int k = 0; k < count; k++)
+									(*ok)[k] = orthogonaliseWindow(sys, (*windows)[first+k],
+																   ORTHOG_METHODS[orthog], (*fs)[k]);
+							}, computePool));
+						last = graph.addTask([winout, windows, offsets, fs, ok, first, count]{
+								for (int k = 0; k < count; k++){
+									(*offsets)[first+k] = winout->tellp();
+									printWindow(*winout, first+k+1, (*windows)[first+k], (*fs)[k], (*ok)[k]);
+								}
+								fs->clear();
+							}, ioPool, deps);
+					}
+
+					graph.addTask([winout, windows, offsets]{
+							printWindowsIndex(*winout, *windows, *offsets);
+							winout->close();
+						}, ioPool, std::vector<int>(1, last));
+					break;
+				}
+				case 3: case 4: case 5: { // Canonical, Gram-Schmidt, or symmetric Lowdin orthogonalisation
+					int orthog = currcmd[0] - 2; // As numbered by printOrthog
+					int n = currcmd[1];
+					// Eigen's solver (as planned), unless parallel was asked for
+					int solver = (currcmd[2] == PARALLEL_EIGEN ? PARALLEL_EIGEN : plan.solver);
+					bool sparse = plan.sparse;
+					// Canonical with a cutoff only finds the eigenpairs below it
+					double cutoff = (cmdParams[c].size() > 0 ? cmdParams[c][0] : 0.0);
+					std::string fname = outputName(ofname, std::string(ORTHOG_NAMES[orthog]) + ".orthog",
+												   usedNames);
+					std::shared_ptr<Eigen::MatrixXd> f = std::make_shared<Eigen::MatrixXd>();
+					int id = graph.addTask([&sys, f, n, orthog, cutoff, solver, sparse, cmdThreads]{
+							if (cutoff > 0.0) canonicalPartial(sys, n, cutoff, *f, solver, sparse, cmdThreads);
+							else orthogonalise(sys, n, ORTHOG_METHODS[orthog], *f, solver, cmdThreads);
+						}, computePool);
+					graph.addTask([&sys, f, fname, orthog, cutoff]{
+							std::ofstream orthogout(fname);
+							printOrthog(sys, orthogout, *f, orthog, cutoff);
+							f->resize(0, 0); // Free the results as soon as they are written
+						}, ioPool, std::vector<int>(1, id));
+				}
+				}
 			}
+			graph.run();
+			printRowCache(sys, output);
+
+			if (program == -1) output << "\nErroneous command given.\n";
+			else output << "\nProgram finished.\n";
 			
 			output.close();
 		}
@@ -6,17 +6,120 @@
  * ==============================================================================
  * 18/12/15         Robert Shaw        Original code.
  * 19/12/15         Robert Shaw        Sparse matrix unpacking added. 
+ * 18/10/26         agent              Unpacking and factorisations moved to the
+ *                                     System's FactorCache.
+ * 18/10/26         agent              Structured coefficients, in-place kernels.
+ * 18/10/26         agent              Partial-spectrum canonical orthogonalisation.
+ * 18/10/26         agent              Choice of eigensolver.
+ * 19/10/26         agent              Partial canonical without the iteration.
+ * 19/10/26         agent              Coefficients point at P, rather than copying it.
+ * 19/10/26         agent              Partial canonical kept functions from the sparse
+ *                                     Cholesky factorisation, not the dense overlap.
+ * 19/10/26         agent              Thread budget of the parallel eigensolver.
+ * 19/10/26         agent              Columns read through RowReader::col.
  *
  **********************************************************************************************/
 
 #include "orthogonalise.hpp"
 #include "system.hpp"
+#include "factorise.hpp"
+#include "storage.hpp"
 #include <Eigen/Eigenvalues>
+#include <Eigen/SparseCholesky>
 #include <iostream>
 #include <cmath>
+#include <algorithm>
+#include <random>
+
+// Number of eigenvectors per rank-k update in symLowdin
+const int LOWDIN_BLOCK = 256;
+
+// Starting block size, and most iterations, of the subspace iteration in
+// canonicalPartial; if the block would have to grow beyond a quarter of the
+// functions, the full eigendecomposition is used instead
+const int PARTIAL_BLOCK = 16;
+const int PARTIAL_ITERATIONS = 200;
+
+// Coefficients constructors
+Coefficients::Coefficients(int n) : type(IDENTITY_COEFFS), rows(n), cols(n),
+									diagonal(0), sparse(0), dense(0)
+{
+}
+
+Coefficients::Coefficients(const Eigen::VectorXd& d) : type(DIAGONAL_COEFFS),
+													   rows(d.size()), cols(d.size()),
+													   diagonal(&d), sparse(0), dense(0)
+{
+}
+
+Coefficients::Coefficients(const Eigen::SparseMatrix<double>& P) : type(SPARSE_COEFFS),
+																   rows(P.rows()), cols(P.cols()),
+																   diagonal(0), sparse(&P), dense(0)
+{
+}
+
+Coefficients::Coefficients(const Eigen::MatrixXd& P) : type(DENSE_COEFFS),
+													   rows(P.rows()), cols(P.cols()),
+													   diagonal(0), sparse(0), dense(&P)
+{
+}
+
+// Overwrite f with P f. Identity and diagonal coefficients are applied in
+// place; a general P needs somewhere to put the product.
+static void applyCoefficients(const Coefficients& P, Eigen::MatrixXd& f)
+{
+	switch(P.type){
+	case IDENTITY_COEFFS: break;
+	case DIAGONAL_COEFFS: {
+		f.array().colwise() *= P.diagonal->array();
+		break;
+	}
+	case SPARSE_COEFFS: {
+		Eigen::MatrixXd Pf = *P.sparse * f;
+		f.swap(Pf);
+		break;
+	}
+	default: {
+		Eigen::MatrixXd Pf;
+		Pf.noalias() = *P.dense * f;
+		f.swap(Pf);
+	}
+	}
+}
+
+// Compute D^-1/2 from the eigenvalues, by taking the inverse square root of each
+// (as D is diagonal). Any non-positive eigenvalues are set to zero, with a warning.
+static Eigen::VectorXd inverseSqrt(const Eigen::VectorXd& values, const char* procedure)
+{
+	Eigen::VectorXd d(values.size());
+	for (int i = 0; i < values.size(); i++){
+		// All the eigenvalues should be positive and non-zero,
+		// but it is worth checking at this stage
+		if (values(i) > 0){
+			d(i) = 1.0/sqrt(values(i));
+		} else {
+			// Throw an error
+			std::cerr << "Non-positive eigenvalue "
+					  << values(i)
+					  << " found in " << procedure << " procedure.\n"
+					  << "Setting to zero.\n";
+			d(i) = 0.0;
+		}
+	}
+	return d;
+}
 
 // Interface to orthogonalise a subset of a System's basis functions
 Eigen::MatrixXd orthogonalise(System& sys, int n_, const int method)
+{
+	Eigen::MatrixXd f;
+	orthogonalise(sys, n_, method, f);
+	return f;
+}
+
+// As above, into caller-provided storage
+void orthogonalise(System& sys, int n_, const int method, Eigen::MatrixXd& f, const int solver,
+				   const int nthreads)
 {
 
 	// Check n_ is at least size 1, and not bigger than the number of
@@ -35,78 +138,38 @@ Eigen::MatrixXd orthogonalise(System& sys, int n_, const int method)
 		n_ = sys.getN();
 	}
 		
-	// Form the overlap matrix of the first n_ basis functions in
-	// system, by starting with a matrix full of zeroes, and then
-	// looping through the vector of non-zero overlap integrals until
-	// all relevant integrals are found
-	
-	Eigen::MatrixXd S = Eigen::MatrixXd::Zero(n_, n_); // n_ x n_ matrix of zeroes
-	
-	// If all the non-diagonal overlap integrals are zero (it could happen!)
-	// then nothing much needs to be done (they're already orthogonal)
-	if ( sys.sInts.size() == sys.getN() ) {
-
-		// S should just be the identity matrix
-		for (int i = 0; i < n_; i++) S(i, i) = 1.0;
-
-	} else {
-
-		// Loop through the sInts, putting the non-zero
-		// integrals into the overlap matrix
-		int count = 1;
-		int position = 0;
-		for (int i = 0; i < n_; i++){
-			for (int j = 0; j < i+1; j++){
-
-				// Check we have not reached the end of sInts
-				if (position < sys.sInts.size()) {
-
-					// If at the correct index, insert integral
-					if (sys.sIndices[position] == count) {
-						S(j, i) = sys.sInts[position];
-						S(i, j) = S(j, i); // Overlap matrix is symmetric
-						// Move to next non-zero integral
-						position++;
-					}
-
-				}
-
-				// Move to next position in matrix
-				count++;
-			}
-		}
-	}
+	// The coefficient matrix for these systems will always be the
+	// identity matrix, as the basis functions are the centres.
+	Coefficients P(n_);
 
-	// Now that the overlap matrix has been formed, call the correct
-	// orthogonalisation routine. The coefficient matrix for these
-	// systems will always be the identity matrix, as the basis functions
-	// are the centres.
-	Eigen::MatrixXd P = Eigen::MatrixXd::Identity(n_, n_);
+	// Call the correct orthogonalisation routine, using the System's
+	// cached overlap matrix and factorisations, so that commands on the
+	// same functions share them rather than each recomputing them
+	FactorCache& factors = sys.getFactors();
 	
 	switch(method){
 
 	case GRAM_SCHMIDT: {
-		S = gramSchmidt(S, P);
+		std::shared_ptr<const Eigen::MatrixXd> L = factors.cholesky(sys, n_);
+		gramSchmidt(L->topLeftCorner(n_, n_), P, f);
 		break;
 	}
 	case CANONICAL: {
-		S = canonical(S, P);
+		canonical(*factors.eigen(sys, n_, solver, nthreads), P, f);
 		break;
 	}
 	case SYM_LOWDIN: {
-		S = symLowdin(S, P);
+		symLowdin(*factors.eigen(sys, n_, solver, nthreads), P, f);
 		break;
 	}
 	default: {
 		// Throw error
 		std::cerr << "Unknown method requested.\n"
 				  << "Defaulting to canonical.\n";
-        S = canonical(S, P);
+        canonical(*factors.eigen(sys, n_, solver, nthreads), P, f);
 	}
 
 	}
-
-	return S;
 }
 
 // Gram-Schmidt orthogonalisation
@@ -114,12 +177,40 @@ Eigen::MatrixXd gramSchmidt(Eigen::MatrixXd& S, Eigen::MatrixXd& P)
 {
 	// Compute Cholesky decomposition, S = LL^T
 	Eigen::LLT<Eigen::MatrixXd> lltOfS(S);
-	// Retrieve lower triangular matrix, L, and compute its inverse
-	Eigen::MatrixXd L = lltOfS.matrixL();
-	L = L.inverse();
 
-	// Return PL^-1
-	return P*L;
+	Eigen::MatrixXd f;
+	gramSchmidt(lltOfS.matrixLLT(), Coefficients(P), f);
+	return f;
+}
+
+// Gram-Schmidt orthogonalisation, given the Cholesky factor
+void gramSchmidt(const Eigen::Ref<const Eigen::MatrixXd>& L, const Coefficients& P,
+				 Eigen::MatrixXd& f)
+{
+	// Start from f = P
+	switch(P.type){
+	case IDENTITY_COEFFS: {
+		f.setIdentity(P.rows, P.cols);
+		break;
+	}
+	case DIAGONAL_COEFFS: {
+		f.setZero(P.rows, P.cols);
+		f.diagonal() = *P.diagonal;
+		break;
+	}
+	case SPARSE_COEFFS: {
+		f.setZero(P.rows, P.cols);
+		for (int k = 0; k < P.sparse->outerSize(); k++)
+			for (Eigen::SparseMatrix<double>::InnerIterator it(*P.sparse, k); it; ++it)
+				f(it.row(), it.col()) = it.value();
+		break;
+	}
+	default: f = *P.dense;
+	}
+
+	// Then solve f L = P for f = P L^-1, overwriting P
+	// (only the lower triangle of L is referenced)
+	L.triangularView<Eigen::Lower>().solveInPlace<Eigen::OnTheRight>(f);
 }
 
 // Canonical orthogonalisation
@@ -127,30 +218,180 @@ Eigen::MatrixXd canonical(Eigen::MatrixXd& S, Eigen::MatrixXd& P)
 {
 	// Calculate eigenvalues/eigenvectors of S (a self adjoint matrix)
 	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(S);
-	// Retrieve eigenvectors
-	Eigen::MatrixXd W = solver.eigenvectors();
-
-	// Retrieve eigenvalues as a diagonal matrix
-	Eigen::MatrixXd D = solver.eigenvalues().asDiagonal();
-	// Compute D^-1/2, simply by taking the inverse square
-	// root of each element (as it is diagonal)
-	for (int i = 0; i < D.rows(); i++){
-		// All the eigenvalues should be positive and non-zero,
-		// but it is worth checking at this stage
-		if (D(i, i) > 0){
-			D(i, i) = 1.0/sqrt(D(i, i));
-		} else {
-			// Throw an error
-			std::cerr << "Non-positive eigenvalue "
-					  << D(i, i)
-					  << " found in canonical procedure.\n"
-					  << "Setting to zero.\n";
-			D(i, i) = 0.0;
+	EigenPairs eig;
+	eig.values = solver.eigenvalues();
+	eig.vectors = solver.eigenvectors();
+
+	Eigen::MatrixXd f;
+	canonical(eig, Coefficients(P), f);
+	return f;
+}
+
+// Canonical orthogonalisation, given the eigendecomposition
+void canonical(const EigenPairs& eig, const Coefficients& P, Eigen::MatrixXd& f)
+{
+	// Compute D^-1/2
+	Eigen::VectorXd d = inverseSqrt(eig.values, "canonical");
+
+	// f = W, with each column scaled by the corresponding element of D^-1/2
+	f = eig.vectors;
+	for (int i = 0; i < d.size(); i++) f.col(i) *= d(i);
+
+	// f = PWD^-1/2
+	applyCoefficients(P, f);
+}
+
+// The lower triangle of the overlap matrix of the first n functions, as a sparse matrix
+static Eigen::SparseMatrix<double> sparseOverlap(const System& sys, int n)
+{
+	std::vector<Eigen::Triplet<double> > entries;
+	RowReader reader(sys);
+	for (int i = 0; i < n; i++){
+		int count = reader.read(i);
+		for (int k = 0; k < count; k++)
+			entries.push_back(Eigen::Triplet<double>(i, reader.col(k), reader.vals[k]));
+	}
+
+	Eigen::SparseMatrix<double> S(n, n);
+	S.setFromTriplets(entries.begin(), entries.end());
+	return S;
+}
+
+// Fill the columns of X from first onwards with random numbers
+static void randomColumns(Eigen::MatrixXd& X, int first, std::mt19937& generator)
+{
+	std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+	for (int j = first; j < X.cols(); j++)
+		for (int i = 0; i < X.rows(); i++) X(i, j) = uniform(generator);
+}
+
+// Find the eigenpairs of S (lower triangle given) with eigenvalues below cutoff, by
+// subspace iteration with (S - sigma)^-1, where the shift sigma is just below zero, so
+// that S - sigma is positive definite even if S is singular, and the smallest
+// eigenvalues of S become the largest of the inverse. Each iteration is followed by a
+// Rayleigh-Ritz step on S, and the block grows whenever it might not hold every
+// eigenvalue below cutoff with one to spare. Those below cutoff must converge; the
+// next need only be known to be above it, as a Ritz value theta with residual r is
+// within r of an eigenvalue. Returns false if the block would grow too big for this
+// to be worthwhile, or it did not converge.
+static bool lowEigenpairs(const Eigen::SparseMatrix<double>& S, double cutoff,
+						  Eigen::MatrixXd& V, Eigen::VectorXd& values)
+{
+	int n = S.rows();
+	double sigma = -1e-3*cutoff;
+	double tol = std::max(1e-12, 1e-3*cutoff);
+
+	Eigen::SparseMatrix<double> shifted = S;
+	for (int i = 0; i < n; i++) shifted.coeffRef(i, i) -= sigma;
+	Eigen::SimplicialLDLT<Eigen::SparseMatrix<double>, Eigen::Lower> solver(shifted);
+	if (solver.info() != Eigen::Success) return false;
+
+	std::mt19937 generator(12345);
+	int b = std::min(PARTIAL_BLOCK, n);
+	Eigen::MatrixXd X(n, b), SX;
+	randomColumns(X, 0, generator);
+
+	for (int iter = 0; iter < PARTIAL_ITERATIONS; iter++){
+		// Apply the inverse, and make the block orthonormal again
+		X = solver.solve(X);
+		Eigen::HouseholderQR<Eigen::MatrixXd> qr(X);
+		X = qr.householderQ() * Eigen::MatrixXd::Identity(n, b);
+
+		// Rayleigh-Ritz - the best approximations to eigenpairs of S within the block
+		SX = S.selfadjointView<Eigen::Lower>() * X;
+		Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> ritz(X.transpose() * SX);
+		X = X * ritz.eigenvectors();
+		SX = SX * ritz.eigenvectors();
+		const Eigen::VectorXd& theta = ritz.eigenvalues();
+
+		int m = 0;
+		while (m < b && theta(m) < cutoff) m++;
+
+		// Grow the block, keeping the Ritz vectors, if it may not hold all of them
+		if (m + 2 > b) {
+			int grown = std::max(2*b, 2*m);
+			if (grown > n/4) return false;
+			X.conservativeResize(n, grown);
+			randomColumns(X, b, generator);
+			b = grown;
+			continue;
 		}
+
+		bool converged = true;
+		for (int i = 0; i < m && converged; i++)
+			converged = (SX.col(i) - theta(i)*X.col(i)).norm() <= tol;
+		converged = converged && theta(m) - (SX.col(m) - theta(m)*X.col(m)).norm() >= cutoff;
+
+		if (converged) {
+			V = X.leftCols(m);
+			values = theta.head(m);
+			return true;
+		}
+	}
+	return false;
+}
+
+// The functions kept by canonical orthogonalisation, from the eigenpairs V, D of S
+// below the cutoff, and the sparse Cholesky factorisation P S P^T = L L^T, where P
+// is a fill-reducing permutation. The columns of B = P^T L^-T are orthonormal over
+// S, and those of U = L^-1 P V D^1/2 are orthonormal, as V^T S^-1 V = D^-1; so if
+// H is the Householder reflection taking U to its first m columns, the columns of
+// f = B H [0; I] are orthonormal over S, and orthogonal to V. Only triangular solves
+// with L, and reflections, are needed. Returns false if S cannot be factorised.
+static bool keptFunctions(const Eigen::SparseMatrix<double>& S, const Eigen::MatrixXd& V,
+						  const Eigen::VectorXd& values, Eigen::MatrixXd& f)
+{
+	int n = S.rows(), m = V.cols(), kept = n - m;
+	if (m > 0 && !(values.minCoeff() > 0.0)) return false;
+
+	Eigen::SimplicialLLT<Eigen::SparseMatrix<double>, Eigen::Lower> llt(S);
+	if (llt.info() != Eigen::Success) return false;
+
+	Eigen::MatrixXd U = llt.permutationP() * V;
+	llt.matrixL().solveInPlace(U);
+	for (int j = 0; j < m; j++) U.col(j) *= sqrt(values(j));
+	Eigen::HouseholderQR<Eigen::MatrixXd> qr(U);
+
+	f.setZero(n, kept);
+	f.bottomRows(kept).setIdentity();
+	if (m > 0) f.applyOnTheLeft(qr.householderQ());
+	llt.matrixU().solveInPlace(f);
+	f = llt.permutationPinv() * f;
+	return true;
+}
+
+// Canonical orthogonalisation, finding only the near-linear dependencies
+int canonicalPartial(System& sys, int n_, double cutoff, Eigen::MatrixXd& f, const int solver,
+					 const bool iterate, const int nthreads)
+{
+	if (n_ <= 0 || n_ > sys.getN()) {
+		std::cerr << "Invalid number of functions to orthogonalise.\n"
+				  << "Doing all available functions instead.\n";
+		n_ = sys.getN();
+	}
+	int n = n_;
+
+	// Find the near-null space by iteration, and the functions kept from the sparse
+	// factorisation, for large enough n; the iteration may not converge, or the
+	// factorisation fail if S is too near to singular
+	bool iterating = iterate && n >= 4*PARTIAL_BLOCK;
+	if (iterating) {
+		Eigen::SparseMatrix<double> S = sparseOverlap(sys, n);
+		Eigen::MatrixXd V;
+		Eigen::VectorXd values;
+		if (lowEigenpairs(S, cutoff, V, values) && keptFunctions(S, V, values, f)) return V.cols();
+		std::cerr << "Subspace iteration did not find the near-linear dependencies.\n"
+				  << "Using the full eigendecomposition instead.\n";
 	}
 
-	// Return PWD^-1/2
-	return P*W*D;
+	// Otherwise, from the full eigendecomposition, f = W D^-1/2 for the
+	// eigenpairs W, D at or above the cutoff
+	std::shared_ptr<const EigenPairs> eig = sys.getFactors().eigen(sys, n, solver, nthreads);
+	int removed = 0;
+	while (removed < n && eig->values(removed) < cutoff) removed++;
+	f = eig->vectors.rightCols(n - removed);
+	for (int j = 0; j < n - removed; j++) f.col(j) /= sqrt(eig->values(removed + j));
+	return removed;
 }
 
 // Symmetric Lowdin orthogonalisation
@@ -158,27 +399,39 @@ Eigen::MatrixXd symLowdin(Eigen::MatrixXd& S, Eigen::MatrixXd& P)
 {
     // Calculate eigenvalues/eigenvectors of S (a self adjoint matrix)
 	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(S);
-	// Retrieve eigenvectors
-	Eigen::MatrixXd W = solver.eigenvectors();
-	
-	// Retrieve eigenvalues as a diagonal matrix
-	Eigen::MatrixXd D = solver.eigenvalues().asDiagonal();
-	// Compute D^1/2
-	for (int i = 0; i < D.rows(); i++){
-		// Eigenvalues should be positive 
-		// but should check here just in case
-		if (D(i, i) > 0){
-			D(i, i) = 1.0/sqrt(D(i, i));
-		} else {
-			// Throw an error
-			std::cerr << "Non-positive eigenvalue "
-					  << D(i, i)
-					  << " found in sym. Lowdin procedure.\n"
-					  << "Setting to zero.\n";
-			D(i, i) = 0.0;
-		}
+	EigenPairs eig;
+	eig.values = solver.eigenvalues();
+	eig.vectors = solver.eigenvectors();
+
+	Eigen::MatrixXd f;
+	symLowdin(eig, Coefficients(P), f);
+	return f;
+}
+
+// Symmetric Lowdin orthogonalisation, given the eigendecomposition
+void symLowdin(const EigenPairs& eig, const Coefficients& P, Eigen::MatrixXd& f)
+{
+	const Eigen::MatrixXd& W = eig.vectors;
+	int n = W.rows();
+
+	// Compute D^-1/2, and then its square root, D^-1/4
+	Eigen::VectorXd d = inverseSqrt(eig.values, "sym. Lowdin");
+	d = d.cwiseSqrt();
+
+	// S^-1/2 = W D^-1/2 W^T = (W D^-1/4)(W D^-1/4)^T, which is accumulated
+	// into the lower triangle of f a block of columns of W at a time
+	f.setZero(n, n);
+	Eigen::MatrixXd block;
+	for (int k = 0; k < W.cols(); k += LOWDIN_BLOCK){
+		int width = std::min(LOWDIN_BLOCK, (int) W.cols() - k);
+		block = W.middleCols(k, width) * d.segment(k, width).asDiagonal();
+		f.selfadjointView<Eigen::Lower>().rankUpdate(block);
 	}
 
-	// Return P S^-1/2 = P W D^-1/2 W^T
-	return P*W*D*W.transpose();
+	// Fill in the upper triangle
+	for (int j = 1; j < n; j++)
+		f.col(j).head(j) = f.row(j).head(j).transpose();
+
+	// f = P S^-1/2
+	applyCoefficients(P, f);
 }
@@ -7,27 +7,72 @@
  * DATE           AUTHOR              CHANGES
  * ==================================================================================
  * 18/12/15       Robert Shaw         Original code.
+ * 18/10/26       agent               Routines taking precomputed factorisations,
+ *                                    structured coefficient matrices, and
+ *                                    writing into caller-provided storage.
+ * 18/10/26       agent               Partial-spectrum canonical orthogonalisation.
+ * 18/10/26       agent               Choice of eigensolver.
+ * 19/10/26       agent               Partial canonical without the iteration.
+ * 19/10/26       agent               Coefficients point at P, rather than copying it.
+ * 19/10/26       agent               Partial canonical without the dense overlap.
+ * 19/10/26       agent               Thread budget of the parallel eigensolver.
  *
  *************************************************************************************************/
 
 #ifndef ORTHOGONALISEHEADERDEF
 #define ORTHOGONALISEHEADERDEF
 
+#include "eigensolver.hpp"
 #include <Eigen/Dense>
+#include <Eigen/Sparse>
 
 // Declare forward dependencies
 class System;
+struct EigenPairs;
 
 // Declare constants
 const int GRAM_SCHMIDT = 1;
 const int CANONICAL = 2;
 const int SYM_LOWDIN = 3;
 
+// Structure of a coefficient matrix
+const int IDENTITY_COEFFS = 0;
+const int DIAGONAL_COEFFS = 1;
+const int SPARSE_COEFFS = 2;
+const int DENSE_COEFFS = 3;
+
+// The coefficient matrix P, whose rows are the basis functions in terms of
+// the Gaussians, described by its structure so that the routines below never
+// have to form (or multiply by) a dense identity or diagonal. Coefficients
+// only point at the diagonal or matrix they are made from, copying nothing,
+// so it must outlive them; they cannot be made from a temporary.
+struct Coefficients
+{
+	int type; // One of the structures above
+	int rows, cols;
+	const Eigen::VectorXd* diagonal; // Only used for DIAGONAL_COEFFS
+	const Eigen::SparseMatrix<double>* sparse; // Only used for SPARSE_COEFFS
+	const Eigen::MatrixXd* dense; // Only used for DENSE_COEFFS
+
+	explicit Coefficients(int n); // n x n identity
+	explicit Coefficients(const Eigen::VectorXd& d); // Diagonal matrix with diagonal d
+	explicit Coefficients(const Eigen::SparseMatrix<double>& P);
+	explicit Coefficients(const Eigen::MatrixXd& P);
+	Coefficients(Eigen::VectorXd&&) = delete;
+	Coefficients(Eigen::SparseMatrix<double>&&) = delete;
+	Coefficients(Eigen::MatrixXd&&) = delete;
+};
+
 // Declare routines
 
 // Interface routine to orthogonalise the first n basis functions
 // in a System, using whichever method specified (default is canonical).
 Eigen::MatrixXd orthogonalise(System& sys, int n_, const int method = CANONICAL);
+// As above, but writing the result into f, reusing its storage if already n x n,
+// and finding the eigendecomposition (if needed) with the given solver, on at most
+// nthreads threads (if nthreads < 1, one per core)
+void orthogonalise(System& sys, int n_, const int method, Eigen::MatrixXd& f,
+				   const int solver = SERIAL_EIGEN, const int nthreads = 0);
 
 // Gram-Schmidt orthogonalisation - returns the matrix f, where
 // the orthogonal functions are given by the rows of  f = P L^-1
@@ -35,15 +80,42 @@ Eigen::MatrixXd orthogonalise(System& sys, int n_, const int method = CANONICAL)
 // lower-triangular matrix from the Cholesky decomposition
 // of the overlap matrix, S
 Eigen::MatrixXd gramSchmidt(Eigen::MatrixXd& S, Eigen::MatrixXd& P);
+// As above, given the Cholesky factor L, writing P L^-1 into f.
+// L^-1 is never formed; P is copied into f and solved against L in place.
+void gramSchmidt(const Eigen::Ref<const Eigen::MatrixXd>& L, const Coefficients& P,
+				 Eigen::MatrixXd& f);
 
 // Canonical orthogonalisation - returns f, as above, but where
 // f = P W D^-1/2, with W the eigenvectors of S, and D the diagonal
 // matrix of eigenvalues of S.
 Eigen::MatrixXd canonical(Eigen::MatrixXd& S, Eigen::MatrixXd& P);
+// As above, given the eigendecomposition, writing P W D^-1/2 into f.
+// W is copied into f and its columns scaled in place.
+void canonical(const EigenPairs& eig, const Coefficients& P, Eigen::MatrixXd& f);
+
+// Canonical orthogonalisation of the first n basis functions in a System, removing
+// their near-linear dependencies - the eigenvectors of S with eigenvalues below
+// cutoff - without a full eigendecomposition, or the dense overlap matrix. Only those
+// eigenpairs are found, by shift-invert subspace iteration on the sparse overlap
+// matrix, and the functions kept are found from its sparse Cholesky factorisation,
+// by triangular solves and Householder reflections, so the result is an orthonormal
+// basis of the same space as canonical orthogonalisation keeps. f has one column per
+// function kept (so is the only dense n x n matrix); returns the number removed. If
+// the full eigendecomposition is needed after all (the iteration does not converge,
+// or S is too near to singular to factorise), it is found with the given solver, on
+// at most nthreads threads; if iterate is false (e.g. as the overlap matrix is too
+// dense for the iteration to pay), it is used from the start.
+int canonicalPartial(System& sys, int n_, double cutoff, Eigen::MatrixXd& f,
+					 const int solver = SERIAL_EIGEN, const bool iterate = true,
+					 const int nthreads = 0);
 
 // Symmetric Lowdin orthogonalisations - returns f, as above, but with
 // f = P S^-1/2, where the inverse square root of a matrix is calculated
 // in the usual way as S^-1/2 = W D^-1/2 W
 Eigen::MatrixXd symLowdin(Eigen::MatrixXd& S, Eigen::MatrixXd& P);
+// As above, given the eigendecomposition, writing P S^-1/2 into f.
+// S^-1/2 is accumulated as symmetric rank-k updates from blocks of
+// scaled eigenvectors, so only an n x (block size) temporary is needed.
+void symLowdin(const EigenPairs& eig, const Coefficients& P, Eigen::MatrixXd& f);
 
 #endif
@@ -0,0 +1,234 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement the planner, which chooses how a System is calculated
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 19/10/26       agent              Original code.
+ * 19/10/26       agent              Gram-Schmidt and local windows in the workload.
+ * 19/10/26       agent              Eigensolver no longer chosen by the number of cores.
+ *
+ ***************************************************************************************/
+
+#include "planner.hpp"
+#include "system.hpp"
+#include "estimate.hpp"
+#include "eigensolver.hpp"
+#include "tasks.hpp"
+#include <Eigen/Dense>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <unistd.h>
+
+// Integrals, and the size of the matrix product, timed to measure the machine
+const int PLAN_TIMED_PAIRS = 20000;
+const int PLAN_TIMED_PRODUCT = 192;
+
+// Bytes per non-zero integral: uncompressed, a double and an int; compressed
+// exactly, a double and (mostly) a one-byte gap between columns; and its
+// gradient, which is never compressed
+const double PLAIN_BYTES = 12.0;
+const double COMPRESSED_BYTES = 9.0;
+const double GRADIENT_BYTES = 24.0;
+
+// Least cache for lazy rows, in MB, as setLazy defaults to
+const double PLAN_MIN_CACHE = 64.0;
+
+// A spatial index is only searched if it leaves at most this fraction of the pairs
+const double PLAN_SCREEN_FRACTION = 0.5;
+
+// calcOverlap is only split between worker processes if it would take longer than
+// this serially, as forking them and reading back their spill files costs time too
+const double PLAN_SHARD_SECONDS = 2.0;
+
+// Canonical orthogonalisation with a cutoff only iterates on the sparse overlap
+// matrix if at most this fraction of it is non-zero; denser, its factorisation
+// costs as much as the full eigendecomposition
+const double PLAN_SPARSE_DENSITY = 0.25;
+
+// Floating point operations of a full eigendecomposition, with eigenvectors, per n^3,
+// and the dense n x n matrices an orthogonalisation holds (the overlap matrix, its
+// eigenvectors, and the result)
+const double EIGEN_FLOPS = 9.0;
+const int DENSE_COPIES = 3;
+
+static double secondsSince(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The timed integrals are summed into this, so that they are not optimised away
+static volatile double timedSum;
+
+// Time the integrals of random pairs of gaussians
+static double timePairs(const System& sys)
+{
+	int N = sys.getN();
+	std::mt19937 gen(N);
+	std::uniform_int_distribution<int> pick(0, N - 1);
+	std::vector<int> first(PLAN_TIMED_PAIRS), second(PLAN_TIMED_PAIRS);
+	for (int k = 0; k < PLAN_TIMED_PAIRS; k++) { first[k] = pick(gen); second[k] = pick(gen); }
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	double sum = 0.0;
+	for (int k = 0; k < PLAN_TIMED_PAIRS; k++)
+		sum += sys.getGaussian(first[k]).overlap(sys.getGaussian(second[k]));
+	timedSum = sum;
+	return secondsSince(start)/PLAN_TIMED_PAIRS;
+}
+
+// Time a dense matrix product, returning floating point operations per second
+static double timeProduct()
+{
+	int n = PLAN_TIMED_PRODUCT;
+	Eigen::MatrixXd A = Eigen::MatrixXd::Random(n, n), B = Eigen::MatrixXd::Random(n, n);
+	Eigen::MatrixXd C(n, n);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	C.noalias() = A*B;
+	double seconds = std::max(secondsSince(start), 1e-6);
+	return 2.0*n*n*(double) n/seconds;
+}
+
+static double physicalMemory()
+{
+	long pages = sysconf(_SC_PHYS_PAGES), size = sysconf(_SC_PAGE_SIZE);
+	return (pages > 0 && size > 0 ? (double) pages*size : 0.0);
+}
+
+static double megabytes(double bytes)
+{
+	return bytes/(1024.0*1024.0);
+}
+
+// The plan is made in the order the choices depend on each other: the storage
+// (which decides whether calcOverlap runs up front at all), the screening, the
+// worker processes (given the predicted time of calcOverlap), and then the
+// orthogonalisations
+Plan makePlan(const System& sys, const PlanPins& pins, const Workload& work)
+{
+	Plan plan;
+	int N = sys.getN();
+	plan.enabled = pins.enabled && N > 0;
+	plan.N = N;
+	plan.storage = (sys.isLazy() ? LAZY_STORAGE : sys.isCompressed() ? COMPRESSED_STORAGE : PLAIN_STORAGE);
+	plan.cacheSize = sys.getCacheSize();
+	plan.screen = false;
+	plan.shards = sys.getShards();
+	plan.threads = defaultThreads();
+	plan.solver = SERIAL_EIGEN;
+	plan.sparse = true;
+	if (!plan.enabled) return plan;
+
+	// Look at the input
+	double lo[3], hi[3];
+	std::vector<double> zetas;
+	for (int k = 0; k < 3; k++) lo[k] = hi[k] = sys.getGaussian(0).getCoord(k);
+	for (int i = 0; i < N; i++){
+		const Gaussian& g = sys.getGaussian(i);
+		for (int k = 0; k < 3; k++){
+			lo[k] = std::min(lo[k], g.getCoord(k));
+			hi[k] = std::max(hi[k], g.getCoord(k));
+		}
+		zetas.push_back(g.getZeta());
+	}
+	std::sort(zetas.begin(), zetas.end());
+	plan.exponents = std::unique(zetas.begin(), zetas.end()) - zetas.begin();
+	for (int k = 0; k < 3; k++) plan.extent[k] = hi[k] - lo[k];
+
+	SparsityEstimate est = estimateSparsity(sys, PLAN_SAMPLES);
+	plan.cutoff = est.cutoff;
+	plan.total = est.total;
+	plan.nearPairs = est.nearPairs;
+	plan.nonzero = est.nonzero;
+	plan.nonzeroError = est.nonzeroError;
+	plan.pairSeconds = timePairs(sys);
+	plan.memory = physicalMemory();
+	plan.flops = (work.dense > 0 || work.partial > 0 ? timeProduct() : 0.0);
+
+	// Memory left for the integrals, once the dense orthogonalisations have theirs:
+	// the largest, or the local windows, one being orthogonalised on each thread
+	double n = std::max(work.dense, work.partial);
+	double m = std::max(n, (double) work.cholesky), w = work.window;
+	plan.denseBytes = std::max(DENSE_COPIES*8.0*m*m, plan.threads*DENSE_COPIES*8.0*w*w);
+	double budget = PLAN_MEMORY_FRACTION*plan.memory - plan.denseBytes;
+
+	// Storage - plain if it fits, else compressed if that fits, else lazy if possible
+	double gradBytes = (work.gradient ? GRADIENT_BYTES*plan.nonzero : 0.0);
+	double plainBytes = PLAIN_BYTES*plan.nonzero + gradBytes;
+	double compressedBytes = COMPRESSED_BYTES*plan.nonzero + gradBytes;
+	bool canBeLazy = !(sys.isPeriodic() || work.gradient || work.sweep);
+	if (!work.overlap) plan.storageReason = "the overlap matrix is not calculated";
+	else if (pins.storage) plan.storageReason = "as given by the input";
+	else if (plan.memory <= 0.0 || plainBytes <= budget) {
+		plan.storage = PLAIN_STORAGE;
+		plan.storageReason = "the integrals fit in memory";
+	} else if (compressedBytes <= budget) {
+		plan.storage = COMPRESSED_STORAGE;
+		plan.storageReason = "the integrals only fit in memory compressed";
+	} else if (canBeLazy) {
+		plan.storage = LAZY_STORAGE;
+		plan.cacheSize = std::max(PLAN_MIN_CACHE, megabytes(budget));
+		plan.storageReason = "the integrals do not fit in memory even compressed";
+	} else {
+		plan.storage = COMPRESSED_STORAGE;
+		plan.storageReason = "the integrals do not fit in memory even compressed, but "
+			"cannot be lazy for periodic systems, gradients, or threshold sweeps";
+	}
+	if (plan.storage == LAZY_STORAGE) plan.bytes = plan.cacheSize*1024.0*1024.0;
+	else plan.bytes = (plan.storage == COMPRESSED_STORAGE ? compressedBytes : plainBytes);
+
+	// Screening - a spatial index, if it rules out enough pairs
+	plan.screen = (plan.nearPairs + N <= PLAN_SCREEN_FRACTION*plan.total);
+	if (sys.isPeriodic()) {
+		plan.screen = true;
+		plan.screenReason = "lattice images are always found from a spatial index";
+	} else if (plan.storage == LAZY_STORAGE) {
+		plan.screen = true;
+		plan.screenReason = "lazy rows are always found from a spatial index";
+	} else if (plan.screen) plan.screenReason = "most pairs are beyond the cutoff radius";
+	else plan.screenReason = "too few pairs are beyond the cutoff radius to be worth it";
+	plan.pairs = (plan.screen ? plan.nearPairs + N : plan.total);
+	if (!work.overlap || plan.storage == LAZY_STORAGE) plan.pairs = 0.0;
+	plan.seconds = plan.pairs*plan.pairSeconds;
+
+	// Worker processes, if calcOverlap would take long enough to be worth them
+	if (plan.pairs == 0.0) plan.threadReason = "no integrals are calculated up front";
+	else if (pins.shards) plan.threadReason = "as given by the input";
+	else if (plan.threads > 1 && plan.seconds > PLAN_SHARD_SECONDS) {
+		plan.shards = plan.threads;
+		plan.threadReason = "the overlap matrix takes long enough to split";
+	} else {
+		plan.shards = 1;
+		plan.threadReason = (plan.threads > 1 ? "the overlap matrix is quick to calculate"
+							 : "there is only one core");
+	}
+	plan.seconds /= plan.shards;
+
+	// The eigensolver is always Eigen's, unless a command asks for the parallel one,
+	// as the two differ in rounding, so results would depend on the number of cores
+	if (n == 0) plan.solverReason = "nothing is orthogonalised from an eigendecomposition";
+	else plan.solverReason = "the parallel solver is only used if a command asks for it";
+	plan.denseSeconds = (plan.flops > 0.0 ? EIGEN_FLOPS*n*n*n/plan.flops : 0.0);
+
+	// Canonical with a cutoff, sparse if the overlap matrix is
+	double density = (plan.total > 0.0 ? plan.nonzero/plan.total : 1.0);
+	plan.sparse = (density <= PLAN_SPARSE_DENSITY);
+	plan.sparseReason = (plan.sparse ? "the overlap matrix is sparse"
+						 : "the overlap matrix is too dense to factorise sparsely");
+	if (work.partial == 0) plan.sparseReason += ", though nothing is orthogonalised with a cutoff";
+
+	return plan;
+}
+
+// Only what differs from the System is changed, so that anything the input
+// fixed (e.g. the quantisation of compressed integrals) is left alone
+void applyPlan(System& sys, const Plan& plan)
+{
+	if (!plan.enabled) return;
+	if (plan.storage == COMPRESSED_STORAGE && !sys.isCompressed()) sys.setCompression(true);
+	if (plan.storage == LAZY_STORAGE && !sys.isLazy()) sys.setLazy(true, plan.cacheSize);
+	sys.setScreening(plan.screen);
+	sys.setShards(plan.shards);
+}
@@ -0,0 +1,124 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To choose how a System is calculated, from the shape of its input, rather
+ *          than leaving every engine to be picked by hand. The same input options
+ *          do not suit both a few atoms and tens of thousands of them, so after the
+ *          input is read, the planner looks at the number of gaussians, their
+ *          exponents (through the cutoff radius), the threshold, the extent of the
+ *          system, and the density of the overlap matrix, estimated by sampling (see
+ *          estimate.hpp), and predicts the time and memory of each choice of:
+ *              storage - the integrals stored plainly, compressed exactly, or
+ *                        calculated lazily into a row cache
+ *              screening - whether calcOverlap looks at every pair of gaussians,
+ *                          or only those found near each other from a spatial index
+ *              threads - the worker processes calcOverlap is split between, and
+ *                        the threads the commands run on
+ *              orthogonalisation - whether canonical orthogonalisation with a cutoff
+ *                        finds the near-linear dependencies by sparse iteration, or
+ *                        from the full eigendecomposition; the eigensolver is always
+ *                        Eigen's unless a command asks for the parallel one, so that
+ *                        the results do not depend on the number of cores
+ *          The time of an integral, and the speed of the dense linear algebra, are
+ *          measured on the machine, rather than assumed. Anything fixed in the
+ *          input is kept as it is. The choices, their reasons, and the predicted
+ *          time and memory are always printed in the main output file; the timings
+ *          of the machine they were made from only if asked for (plan, print).
+ *
+ * CONTAINS:
+ *          struct PlanPins - what the input fixed, so is not planned
+ *          struct Workload - what the commands need of the System
+ *          struct Plan - the choices made, the reasons for them, and what was
+ *                        predicted and measured to make them
+ *          makePlan(sys, pins, work) - plan the calculation of sys
+ *          applyPlan(sys, plan) - set sys up as planned, before calcOverlap
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 19/10/26     agent            Original code.
+ * 19/10/26     agent            Gram-Schmidt and local windows in the workload;
+ *                               plan printed on request.
+ * 19/10/26     agent            Eigensolver no longer chosen by the number of cores.
+ * 19/10/26     agent            Plan always printed; timings on request.
+ *
+ ************************************************************************************/
+
+#ifndef PLANNERHEADERDEF
+#define PLANNERHEADERDEF
+
+#include <string>
+
+// Declare forward dependencies
+class System;
+
+// Ways of storing the integrals
+const int PLAIN_STORAGE = 0;
+const int COMPRESSED_STORAGE = 1;
+const int LAZY_STORAGE = 2;
+
+// Pairs sampled to estimate the density of the overlap matrix
+const int PLAN_SAMPLES = 4096;
+// Fraction of physical memory the integrals and dense matrices may take
+const double PLAN_MEMORY_FRACTION = 0.5;
+
+struct PlanPins
+{
+	bool enabled; // Whether to plan at all
+	bool storage; // Compression or laziness was given
+	bool shards; // The number of worker processes was given
+	bool print; // Whether the timings of the machine are printed with the plan
+};
+
+struct Workload
+{
+	bool overlap; // Whether the overlap matrix is calculated at all
+	bool gradient; // Whether its gradient is too
+	bool sweep; // Whether there is a threshold sweep
+	int dense; // Most functions orthogonalised from a full eigendecomposition, or 0
+	int partial; // Most functions in a canonical orthogonalisation with a cutoff, or 0
+	int cholesky; // Most functions orthogonalised by Gram-Schmidt, from a Cholesky factor, or 0
+	int window; // Most functions in a local window, or 0
+};
+
+struct Plan
+{
+	bool enabled; // False if everything is as the input gave it
+
+	// What was looked at
+	int N; // Number of gaussians
+	int exponents; // Distinct exponents
+	double extent[3]; // Sides of the box around the gaussians
+	double cutoff; // Cutoff radius
+	double total; // Possible unique integrals
+	double nearPairs; // Of those, pairs in the same or neighbouring cells
+	double nonzero; // Estimated number of non-zero integrals
+	double nonzeroError; // Half-width of its 95% confidence interval
+	double pairSeconds; // Measured time of one integral
+	double flops; // Measured speed of a dense matrix product
+	double memory; // Bytes of physical memory
+
+	// The choices, and why they were made
+	int storage; // One of the ways of storing the integrals, above
+	double cacheSize; // MB of rows to cache, if lazy
+	bool screen; // Whether calcOverlap searches a spatial index
+	int shards; // Worker processes for calcOverlap
+	int threads; // Threads to run the commands on
+	int solver; // Eigensolver for the dense orthogonalisations, unless a command picks one
+	bool sparse; // Whether canonical with a cutoff iterates on the sparse overlap
+	std::string storageReason, screenReason, threadReason, solverReason, sparseReason;
+
+	// Predictions
+	double pairs; // Integrals calculated by calcOverlap
+	double seconds; // Time taken by calcOverlap
+	double bytes; // Storage of the integrals
+	double denseSeconds; // Time of the largest full eigendecomposition
+	double denseBytes; // Memory of the largest dense orthogonalisation, or of the
+					   // local windows orthogonalised at once, if more
+};
+
+// Plan the calculation of sys, given what the input fixed and what the commands need
+Plan makePlan(const System& sys, const PlanPins& pins, const Workload& work);
+
+// Set sys up to be calculated as planned; must be called before calcOverlap
+void applyPlan(System& sys, const Plan& plan);
+
+#endif
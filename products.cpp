@@ -0,0 +1,173 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement class OverlapOperator, and the Lanczos spectrum estimate
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ * 18/10/26       agent              Rows read through a RowReader.
+ * 18/10/26       agent              Lazy rows.
+ * 19/10/26       agent              Products refused without rows; per-product buffers.
+ * 19/10/26       agent              Columns read through RowReader::col.
+ *
+ ***************************************************************************************/
+
+#include "products.hpp"
+#include "system.hpp"
+#include "storage.hpp"
+#include <Eigen/Eigenvalues>
+#include <iostream>
+#include <random>
+#include <cmath>
+#include <algorithm>
+
+// Constructor - split the rows into one chunk per thread, each with
+// roughly the same number of stored integrals (or of rows, if they
+// are calculated lazily, and so not known in advance)
+OverlapOperator::OverlapOperator(const System& sys_, int nthreads) : sys(sys_), N(sys_.getN()),
+																	  valid(sys_.hasRows()), pool(nthreads)
+{
+	// Without rows there is nothing to split, so a single chunk is kept
+	// for the layout, and products are refused
+	chunkStart.push_back(0);
+	if (!valid) {
+		std::cerr << "Overlap integrals must be calculated before forming products.\n";
+		chunkStart.push_back(N);
+		return;
+	}
+
+	int nchunks = std::max(1, std::min(nthreads, N));
+	double perChunk = (double) sys.getNonZero() / nchunks;
+
+	if (sys.hasOverlap()) {
+		for (int i = 0; i < N && chunkStart.size() < nchunks; i++)
+			if (sys.sRowStart[i+1] >= perChunk*chunkStart.size()) chunkStart.push_back(i+1);
+	} else {
+		for (int c = 1; c < nchunks; c++) chunkStart.push_back(((long long) N*c)/nchunks);
+	}
+	chunkStart.push_back(N);
+}
+
+// y = S x, or y = x if there are no integrals
+void OverlapOperator::multiply(const Eigen::VectorXd& x, Eigen::VectorXd& y) const
+{
+	if (!valid) {
+		std::cerr << "Cannot multiply by an overlap matrix that has not been calculated.\n";
+		y = x;
+		return;
+	}
+	y.resize(N);
+	apply(x.data(), y.data(), 1);
+}
+
+// Y = S X, or Y = X if there are no integrals
+void OverlapOperator::multiply(const VectorBlock& X, VectorBlock& Y) const
+{
+	if (!valid) {
+		std::cerr << "Cannot multiply by an overlap matrix that has not been calculated.\n";
+		Y = X;
+		return;
+	}
+	Y.resize(N, X.cols());
+	apply(X.data(), Y.data(), X.cols());
+}
+
+// Run every chunk in parallel, then add the scattered contributions that
+// each chunk made to the rows before it into those rows. The buffers belong
+// to this product alone, so that concurrent products do not share them.
+void OverlapOperator::apply(const double* x, double* y, int k) const
+{
+	int nchunks = chunkStart.size() - 1;
+	std::vector<std::vector<double> > buffers(nchunks);
+
+	for (int c = 0; c < nchunks; c++)
+		pool.submit([this, c, x, y, k, &buffers]{ applyChunk(c, x, y, k, buffers[c]); });
+	pool.wait();
+
+	for (int c = 0; c < nchunks-1; c++)
+		pool.submit([this, c, nchunks, y, k, &buffers]{
+				int first = chunkStart[c]*k, last = chunkStart[c+1]*k;
+				for (int t = c+1; t < nchunks; t++){
+					const double* buf = buffers[t].data();
+					for (int p = first; p < last; p++) y[p] += buf[p];
+				}
+			});
+	pool.wait();
+}
+
+// Multiply the rows of the lower triangle in one chunk. Contributions to rows
+// in the chunk go straight into y; those to earlier rows, which belong to
+// other chunks, go into this chunk's buffer.
+void OverlapOperator::applyChunk(int chunk, const double* x, double* y, int k,
+								 std::vector<double>& buffer) const
+{
+	int first = chunkStart[chunk], last = chunkStart[chunk+1];
+
+	buffer.assign((std::size_t) first*k, 0.0);
+	std::fill(y + (std::size_t) first*k, y + (std::size_t) last*k, 0.0);
+
+	RowReader reader(sys);
+
+	for (int i = first; i < last; i++){
+		const double* xi = x + (std::size_t) i*k;
+		double* yi = y + (std::size_t) i*k;
+
+		int count = reader.read(i);
+		for (int p = 0; p < count; p++){
+			int j = reader.col(p);
+			double s = reader.vals[p];
+			const double* xj = x + (std::size_t) j*k;
+
+			// S_ij x_j into y_i
+			for (int c = 0; c < k; c++) yi[c] += s*xj[c];
+
+			// and S_ji x_i into y_j, off the diagonal
+			if (j != i) {
+				double* yj = (j >= first ? y : buffer.data()) + (std::size_t) j*k;
+				for (int c = 0; c < k; c++) yj[c] += s*xi[c];
+			}
+		}
+	}
+}
+
+// Lanczos estimate of the extreme eigenvalues of S. The extreme eigenvalues of
+// the tridiagonal matrix T built up converge quickly to those of S, so no
+// reorthogonalisation is done, and only three vectors are kept.
+int estimateSpectrum(const OverlapOperator& op, int steps, double& lmin, double& lmax)
+{
+	int N = op.size();
+	steps = std::max(1, std::min(steps, N));
+
+	// Start from a (reproducible) random unit vector
+	std::mt19937 generator(12345);
+	std::uniform_real_distribution<double> uniform(-1.0, 1.0);
+	Eigen::VectorXd v(N), vlast = Eigen::VectorXd::Zero(N), w;
+	for (int i = 0; i < N; i++) v(i) = uniform(generator);
+	v.normalize();
+
+	std::vector<double> alpha, beta;
+	double b = 0.0;
+	for (int j = 0; j < steps; j++){
+		op.multiply(v, w);
+		double a = w.dot(v);
+		w -= a*v + b*vlast;
+		alpha.push_back(a);
+
+		b = w.norm();
+		if (b < 1e-12 || j == steps-1) break; // Invariant subspace found, or done
+		beta.push_back(b);
+
+		vlast.swap(v);
+		v = w/b;
+	}
+
+	// Eigenvalues of the tridiagonal matrix, in ascending order
+	Eigen::VectorXd diag = Eigen::Map<Eigen::VectorXd>(alpha.data(), alpha.size());
+	Eigen::VectorXd subdiag = Eigen::Map<Eigen::VectorXd>(beta.data(), beta.size());
+	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver;
+	solver.computeFromTridiagonal(diag, subdiag, Eigen::EigenvaluesOnly);
+
+	lmin = solver.eigenvalues()(0);
+	lmax = solver.eigenvalues()(alpha.size() - 1);
+	return alpha.size();
+}
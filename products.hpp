@@ -0,0 +1,82 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To provide products of the overlap matrix with vectors and blocks of
+ *          vectors, working directly on the lower triangle stored by a System,
+ *          so that iterative methods can be applied to overlap matrices far too big
+ *          to be made dense.
+ *
+ * CONTAINS:
+ *          class OverlapOperator:
+ *              data:
+ *                  sys - the System whose overlap matrix is used
+ *                  chunkStart - the rows at which each thread's share of the matrix
+ *                               begins, chosen so that each has a similar number
+ *                               of non-zero integrals
+ *                  pool - the threads used for the products
+ *                  valid - false if the System had no overlap integrals, in which
+ *                          case the products are refused, and y = x returned
+ *              routines:
+ *                  multiply(x, y) - y = S x
+ *                  multiply(X, Y) - Y = S X, for a block X of vectors stored row-major,
+ *                                   so that the update for each integral is a
+ *                                   contiguous (vectorisable) row operation
+ *
+ *          estimateSpectrum(op, steps, lmin, lmax) - estimates the extreme eigenvalues
+ *                  of S by the Lanczos method, returning the number of steps taken
+ *
+ *          Each stored integral S_ij (j <= i) contributes both S_ij x_j to y_i and,
+ *          if j < i, S_ij x_i to y_j; the upper triangle is never stored. The
+ *          scatter buffers are allocated by each product, so several threads may
+ *          multiply by the same operator at once.
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 18/10/26     agent            Original code.
+ * 19/10/26     agent            Thread budget of the products documented.
+ *
+ ************************************************************************************/
+
+#ifndef PRODUCTSHEADERDEF
+#define PRODUCTSHEADERDEF
+
+#include <Eigen/Dense>
+#include <vector>
+#include "tasks.hpp"
+
+// Declare forward dependencies
+class System;
+
+// A block of vectors, one per column, stored so that each row is contiguous
+typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> VectorBlock;
+
+class OverlapOperator
+{
+private:
+	const System& sys;
+	int N;
+	bool valid; // False if sys had no overlap integrals to multiply by
+	std::vector<int> chunkStart; // First row of each chunk, with chunkStart.back() = N
+	mutable ThreadPool pool; // Thread-safe, so shared by concurrent products
+
+	// y = S x for k vectors stored row-major in x and y
+	void apply(const double* x, double* y, int k) const;
+	// The contribution of rows first to last-1, into y and the chunk's scatter buffer
+	void applyChunk(int chunk, const double* x, double* y, int k,
+					std::vector<double>& buffer) const;
+public:
+	// The products run on a pool of nthreads threads of the operator's own, so a
+	// caller that is itself a task on a pool should pass its share of that pool
+	OverlapOperator(const System& sys_, int nthreads = defaultThreads());
+
+	int size() const { return N; }
+	bool isValid() const { return valid; }
+
+	void multiply(const Eigen::VectorXd& x, Eigen::VectorXd& y) const;
+	void multiply(const VectorBlock& X, VectorBlock& Y) const;
+};
+
+// Estimate the smallest and largest eigenvalues of S using at most steps
+// Lanczos iterations; returns the number of iterations actually taken
+int estimateSpectrum(const OverlapOperator& op, int steps, double& lmin, double& lmax);
+
+#endif
@@ -0,0 +1,216 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement the sparse graph pyramid
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ * 18/10/26       agent              Rows read through a RowReader.
+ * 19/10/26       agent              Levels held sparsely, as the pixels that are not empty.
+ * 19/10/26       agent              Columns read through RowReader::col.
+ *
+ ***************************************************************************************/
+
+#include "pyramid.hpp"
+#include "system.hpp"
+#include "storage.hpp"
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cmath>
+#include <cerrno>
+#include <sys/stat.h>
+
+// Shade of a pixel - 0 (black) for the largest mean, to 255 (white)
+// for PYRAMID_DECADES decades below it, or empty
+static unsigned char shade(double mean, double maxMean)
+{
+	if (mean <= 0.0 || maxMean <= 0.0) return 255;
+	double decades = -log10(mean/maxMean);
+	return (unsigned char) std::min(255.0, round(255.0*decades/PYRAMID_DECADES));
+}
+
+// A pixel that is not empty, holding the sum of the integrals in its block; a level
+// holds its pixels in order of row a, then column b, with both (a, b) and (b, a)
+struct Pixel
+{
+	int a, b;
+	double sum;
+	bool operator<(const Pixel& other) const
+	{
+		return a < other.a || (a == other.a && b < other.b);
+	}
+};
+
+// Sort pixels, and merge any with the same row and column
+static void mergePixels(std::vector<Pixel>& pixels)
+{
+	std::sort(pixels.begin(), pixels.end());
+	std::size_t kept = 0;
+	for (std::size_t p = 0; p < pixels.size(); p++){
+		if (kept > 0 && pixels[kept-1].a == pixels[p].a && pixels[kept-1].b == pixels[p].b)
+			pixels[kept-1].sum += pixels[p].sum;
+		else pixels[kept++] = pixels[p];
+	}
+	pixels.resize(kept);
+}
+
+// Write one level, of n x n pixels, as tiles; returns false on failure. Only one
+// row of tiles is held densely at a time.
+static bool writeLevel(const std::string& dir, int level, int n, int tileSize,
+					   const std::vector<Pixel>& pixels, const std::vector<double>& sizes,
+					   double maxMean)
+{
+	int tiles = (n + tileSize - 1)/tileSize;
+	std::vector<double> band;
+	std::vector<unsigned char> row;
+	std::size_t next = 0;
+	bool ok = true;
+
+	for (int tr = 0; tr < tiles; tr++){
+		int h = std::min(tileSize, n - tr*tileSize);
+		band.assign((std::size_t) h*n, 0.0);
+		for (; next < pixels.size() && pixels[next].a < tr*tileSize + h; next++)
+			band[(std::size_t) (pixels[next].a - tr*tileSize)*n + pixels[next].b] = pixels[next].sum;
+
+		for (int tc = 0; tc < tiles; tc++){
+			int w = std::min(tileSize, n - tc*tileSize);
+			std::string name = dir + "/" + std::to_string(level) + "_" + std::to_string(tr)
+				+ "_" + std::to_string(tc) + ".pgm";
+			std::ofstream tile(name, std::ios::binary);
+
+			// Binary greyscale PGM
+			tile << "P5\n" << w << " " << h << "\n255\n";
+			row.resize(w);
+			for (int r = 0; r < h; r++){
+				int a = tr*tileSize + r;
+				for (int c = 0; c < w; c++){
+					int b = tc*tileSize + c;
+					row[c] = shade(band[(std::size_t) r*n + b]/(sizes[a]*sizes[b]), maxMean);
+				}
+				tile.write(reinterpret_cast<const char*>(row.data()), w);
+			}
+
+			if (!tile) {
+				std::cerr << "Could not write sparse graph tile " << name << "\n";
+				ok = false;
+			}
+		}
+	}
+	return ok;
+}
+// Write the pyramid, finest level first
+bool writePyramid(const System& sys, const std::string& dir, int fineness, int tileSize)
+{
+	int N = sys.getN();
+	if (N == 0) return true;
+
+	// Fineness only makes sense if positive, and at most one function per pixel
+	if (fineness < 1 || fineness > N) {
+		std::cerr << "Invalid choice of fineness - must be between 1 and N.\n";
+		fineness = std::max(1, std::min(fineness, N));
+	}
+	if (tileSize < 1) tileSize = 256;
+
+	int blocksize = (N + fineness - 1)/fineness; // Functions per pixel
+	int n = (N + blocksize - 1)/blocksize; // Pixels along each side
+
+	if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST) {
+		std::cerr << "Could not make the sparse graph directory " << dir << "\n";
+		return false;
+	}
+
+	// Sum the integrals into the finest level, in one pass, a row of pixels at a
+	// time. Each integral S_ij (j < i) is also S_ji, so contributes to both pixels;
+	// the lower triangle is summed here, and mirrored below.
+	std::vector<Pixel> pixels;
+	std::vector<double> rowSums(n, 0.0);
+	std::vector<int> touched, seen(n, -1);
+	RowReader reader(sys);
+	for (int a = 0; a < n; a++){
+		for (int i = a*blocksize; i < std::min(N, (a+1)*blocksize); i++){
+			int count = reader.read(i);
+			for (int p = 0; p < count; p++){
+				int j = reader.col(p);
+				int b = j/blocksize;
+				if (seen[b] != a) {
+					seen[b] = a;
+					touched.push_back(b);
+				}
+				rowSums[b] += (j != i && b == a ? 2.0 : 1.0)*reader.vals[p];
+			}
+		}
+		for (int t = 0; t < (int) touched.size(); t++){
+			int b = touched[t];
+			Pixel pixel = { a, b, rowSums[b] };
+			pixels.push_back(pixel);
+			if (b != a) {
+				pixel.a = b;
+				pixel.b = a;
+				pixels.push_back(pixel);
+			}
+			rowSums[b] = 0.0;
+		}
+		touched.clear();
+	}
+	mergePixels(pixels);
+
+	// Number of functions along each side of each pixel
+	std::vector<double> sizes(n);
+	for (int a = 0; a < n; a++) sizes[a] = std::min(blocksize, N - a*blocksize);
+
+	std::ofstream index(dir + "/index");
+	index << "SPARSE GRAPH PYRAMID\n\n"
+		  << "For " << N << " basis functions, with a threshold of " << sys.getThreshold() << "\n"
+		  << "Each level is cut into tiles of at most " << tileSize << " x " << tileSize
+		  << " pixels, in files level_row_col.pgm.\n"
+		  << "Pixels are shaded by the mean integral in their block, from black at the\n"
+		  << "largest mean in the level to white " << PYRAMID_DECADES
+		  << " decades below it, or when empty.\n\n"
+		  << std::setw(8) << "Level"
+		  << std::setw(10) << "Pixels"
+		  << std::setw(18) << "Functions/pixel"
+		  << std::setw(10) << "Tiles"
+		  << std::setw(16) << "Largest mean\n"
+		  << std::string(62, '.') << "\n";
+
+	bool ok = true;
+	for (int level = 0; ; level++){
+		double maxMean = 0.0;
+		for (std::size_t p = 0; p < pixels.size(); p++)
+			maxMean = std::max(maxMean, pixels[p].sum/(sizes[pixels[p].a]*sizes[pixels[p].b]));
+
+		ok = writeLevel(dir, level, n, tileSize, pixels, sizes, maxMean) && ok;
+		int tiles = (n + tileSize - 1)/tileSize;
+
+		// The first pixel is always full; the last may be smaller
+		index << std::setw(8) << level
+			  << std::setw(10) << n
+			  << std::setw(18) << (int) sizes[0]
+			  << std::setw(10) << tiles*tiles
+			  << std::setw(15) << std::setprecision(6) << maxMean << "\n";
+
+		if (n == 1) break;
+
+		// Sum each 2 x 2 square of pixels into the next level
+		int m = (n + 1)/2;
+		for (std::size_t p = 0; p < pixels.size(); p++){
+			pixels[p].a /= 2;
+			pixels[p].b /= 2;
+		}
+		mergePixels(pixels);
+		std::vector<double> coarseSizes(m, 0.0);
+		for (int a = 0; a < n; a++) coarseSizes[a/2] += sizes[a];
+
+		sizes.swap(coarseSizes);
+		n = m;
+	}
+
+	if (!index) {
+		std::cerr << "Could not write the sparse graph index in " << dir << "\n";
+		ok = false;
+	}
+	return ok;
+}
@@ -0,0 +1,48 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To write a multi-resolution (mipmap) pyramid of the sparse graph of the
+ *          overlap matrix as greyscale images, so that any zoom level of a large
+ *          system can be viewed without recalculating, or a plotting script.
+ *
+ *          The finest level is made in one pass through the stored integrals, each
+ *          pixel holding the sum of the integrals in a block of the (full, symmetric)
+ *          overlap matrix. Each coarser level sums 2 x 2 pixels of the one before, so
+ *          each level is exact, down to a single pixel. Levels are held sparsely, as
+ *          the pixels that are not empty, so their memory grows with the number of
+ *          non-empty blocks rather than the square of the side; only one row of
+ *          tiles is held densely, while it is written. Pixels are shaded by the
+ *          mean integral in their block, on a log scale of PYRAMID_DECADES decades
+ *          below the largest mean in the level, black being the densest and white
+ *          empty.
+ *
+ *          Each level is cut into square tiles, written as binary PGM files named
+ *          level_row_col.pgm in the given directory, together with a text index
+ *          giving the size of each level, its blocks, tiles, and shading.
+ *
+ * CONTAINS:
+ *          writePyramid(sys, dir, fineness, tileSize) - write the pyramid with at
+ *                                     most fineness pixels along the side of the
+ *                                     finest level; returns false if any file
+ *                                     could not be written
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 18/10/26     agent            Original code.
+ * 19/10/26     agent            Levels held sparsely.
+ *
+ ************************************************************************************/
+
+#ifndef PYRAMIDHEADERDEF
+#define PYRAMIDHEADERDEF
+
+#include <string>
+
+// Declare forward dependencies
+class System;
+
+// Number of decades of mean integral shaded from black to white
+const int PYRAMID_DECADES = 8;
+
+bool writePyramid(const System& sys, const std::string& dir, int fineness, int tileSize = 256);
+
+#endif
@@ -0,0 +1,196 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement class SpatialIndex, and the overlap cutoff radius
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ * 18/10/26       agent              Lattice images.
+ * 18/10/26       agent              Cutoff radius between two systems.
+ * 19/10/26       agent              Cutoff radius between two exponents.
+ *
+ ***************************************************************************************/
+
+#include "spatial.hpp"
+#include "system.hpp"
+#include <algorithm>
+#include <cmath>
+
+// Cell coordinates are stored in 21 bits each, offset so that
+// cells either side of the origin can be represented
+const int CELL_BITS = 21;
+const int CELL_OFFSET = 1 << (CELL_BITS - 1);
+
+long long SpatialIndex::pack(int cx, int cy, int cz)
+{
+	return ( ((long long) (cx + CELL_OFFSET)) << (2*CELL_BITS) )
+		| ( ((long long) (cy + CELL_OFFSET)) << CELL_BITS )
+		| ( (long long) (cz + CELL_OFFSET) );
+}
+
+// Constructor - sort the Gaussians by the cell they lie in
+SpatialIndex::SpatialIndex(const System& sys, double cellSize_, int n) : cellSize(cellSize_)
+{
+	if (n < 0 || n > sys.getN()) n = sys.getN();
+
+	// Find the extent of the Gaussians
+	double top[3];
+	for (int k = 0; k < 3; k++) { origin[k] = 0.0; top[k] = 0.0; }
+	for (int i = 0; i < n; i++){
+		for (int k = 0; k < 3; k++){
+			double x = sys.getGaussian(i).getCoord(k);
+			if (i == 0 || x < origin[k]) origin[k] = x;
+			if (i == 0 || x > top[k]) top[k] = x;
+		}
+	}
+
+	// Cells cannot be so small that their coordinates overflow
+	double extent = std::max(top[0] - origin[0], std::max(top[1] - origin[1], top[2] - origin[2]));
+	cellSize = std::max(cellSize, std::max(extent/(CELL_OFFSET - 2), 1e-8));
+
+	// Sort by packed cell coordinates
+	std::vector<std::pair<long long, int> > cells(n);
+	int cx, cy, cz;
+	for (int i = 0; i < n; i++){
+		const Gaussian& g = sys.getGaussian(i);
+		cellOf(g.getCoord(0), g.getCoord(1), g.getCoord(2), cx, cy, cz);
+		cells[i] = std::make_pair(pack(cx, cy, cz), i);
+	}
+	std::sort(cells.begin(), cells.end());
+
+	order.resize(n);
+	for (int i = 0; i < n; i++){
+		order[i] = cells[i].second;
+		if (i == 0 || cells[i].first != cells[i-1].first) {
+			keys.push_back(cells[i].first);
+			starts.push_back(i);
+		}
+	}
+	starts.push_back(n);
+}
+
+// Integer coordinates of the cell containing a point
+void SpatialIndex::cellOf(double x, double y, double z, int& cx, int& cy, int& cz) const
+{
+	cx = (int) floor((x - origin[0])/cellSize);
+	cy = (int) floor((y - origin[1])/cellSize);
+	cz = (int) floor((z - origin[2])/cellSize);
+}
+
+// Find an occupied cell by binary search of the keys
+int SpatialIndex::findCell(int cx, int cy, int cz) const
+{
+	if (std::abs(cx) >= CELL_OFFSET || std::abs(cy) >= CELL_OFFSET || std::abs(cz) >= CELL_OFFSET)
+		return -1;
+	long long key = pack(cx, cy, cz);
+	std::vector<long long>::const_iterator it = std::lower_bound(keys.begin(), keys.end(), key);
+	if (it == keys.end() || *it != key) return -1;
+	return it - keys.begin();
+}
+
+// Unpack the integer coordinates of cell c
+void SpatialIndex::cellCoords(int c, int& cx, int& cy, int& cz) const
+{
+	long long mask = (1LL << CELL_BITS) - 1;
+	cx = (int) ((keys[c] >> (2*CELL_BITS)) & mask) - CELL_OFFSET;
+	cy = (int) ((keys[c] >> CELL_BITS) & mask) - CELL_OFFSET;
+	cz = (int) (keys[c] & mask) - CELL_OFFSET;
+}
+
+// All Gaussians within radius of a point, found by checking only
+// those cells that lie (at least partly) within radius
+void SpatialIndex::near(const System& sys, double x, double y, double z, double radius,
+						std::vector<int>& result) const
+{
+	int cx, cy, cz;
+	cellOf(x, y, z, cx, cy, cz);
+	int reach = (int) ceil(radius/cellSize);
+	double r2 = radius*radius;
+
+	for (int dx = -reach; dx <= reach; dx++){
+		for (int dy = -reach; dy <= reach; dy++){
+			for (int dz = -reach; dz <= reach; dz++){
+				int c = findCell(cx + dx, cy + dy, cz + dz);
+				if (c < 0) continue;
+				for (int p = starts[c]; p < starts[c+1]; p++){
+					const Gaussian& g = sys.getGaussian(order[p]);
+					double ex = g.getCoord(0) - x, ey = g.getCoord(1) - y, ez = g.getCoord(2) - z;
+					if (ex*ex + ey*ey + ez*ez <= r2) result.push_back(order[p]);
+				}
+			}
+		}
+	}
+}
+
+// The overlap of two normalised s-type Gaussians with exponents a and b a
+// distance r apart is
+//      ( 2 sqrt(ab)/(a+b) )^3/2 exp( -ab r^2/(a+b) )
+// so it is below threshold for all r beyond the square root of
+//      ln( prefactor/threshold ) (a+b)/ab
+// and the cutoff radius is the largest of these over all pairs of exponents.
+double cutoffRadius(const System& sys, double threshold)
+{
+	return cutoffRadius(sys, sys, threshold);
+}
+
+// The distinct exponents of the Gaussians in sys
+static std::vector<double> distinctZetas(const System& sys)
+{
+	std::vector<double> zetas;
+	for (int i = 0; i < sys.getN(); i++) zetas.push_back(sys.getGaussian(i).getZeta());
+	std::sort(zetas.begin(), zetas.end());
+	zetas.erase(std::unique(zetas.begin(), zetas.end()), zetas.end());
+	return zetas;
+}
+
+// As above, over the pairs of an exponent in sysA with one in sysB
+double cutoffRadius(const System& sysA, const System& sysB, double threshold)
+{
+	std::vector<double> zetasA = distinctZetas(sysA);
+	std::vector<double> zetasB = (&sysA == &sysB ? zetasA : distinctZetas(sysB));
+
+	double radius = 0.0;
+	for (int i = 0; i < zetasA.size(); i++)
+		for (int j = 0; j < zetasB.size(); j++)
+			radius = std::max(radius, zetaCutoff(zetasA[i], zetasB[j], threshold));
+	return radius;
+}
+
+// As above, for a single pair of exponents
+double zetaCutoff(double a, double b, double threshold)
+{
+	double prefactor = pow(2.0*sqrt(a*b)/(a+b), 1.5);
+	if (prefactor < threshold) return 0.0;
+	return sqrt(log(prefactor/threshold)*(a+b)/(a*b));
+}
+
+// The planes of lattice points along a_k are 1/|b_k| apart, where b_k is the
+// reciprocal lattice vector (a_l x a_m)/V, so no translation within reach
+// has |n_k| greater than reach |b_k|.
+void latticeImages(const std::vector<double>& cell, double reach, std::vector<double>& shifts)
+{
+	const double* a = cell.data();
+	double volume = a[0]*(a[4]*a[8] - a[5]*a[7]) - a[1]*(a[3]*a[8] - a[5]*a[6])
+		+ a[2]*(a[3]*a[7] - a[4]*a[6]);
+
+	int nmax[3];
+	for (int k = 0; k < 3; k++){
+		const double* u = a + 3*((k+1)%3);
+		const double* v = a + 3*((k+2)%3);
+		double bx = u[1]*v[2] - u[2]*v[1], by = u[2]*v[0] - u[0]*v[2], bz = u[0]*v[1] - u[1]*v[0];
+		nmax[k] = (int) ceil(reach*sqrt(bx*bx + by*by + bz*bz)/fabs(volume));
+	}
+
+	shifts.push_back(0.0); shifts.push_back(0.0); shifts.push_back(0.0);
+	for (int n1 = -nmax[0]; n1 <= nmax[0]; n1++){
+		for (int n2 = -nmax[1]; n2 <= nmax[1]; n2++){
+			for (int n3 = -nmax[2]; n3 <= nmax[2]; n3++){
+				if (n1 == 0 && n2 == 0 && n3 == 0) continue;
+				double L[3];
+				for (int k = 0; k < 3; k++) L[k] = n1*a[k] + n2*a[3+k] + n3*a[6+k];
+				if (L[0]*L[0] + L[1]*L[1] + L[2]*L[2] <= reach*reach)
+					shifts.insert(shifts.end(), L, L + 3);
+			}
+		}
+	}
+}
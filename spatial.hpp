@@ -0,0 +1,96 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To provide a spatial index of the Gaussians in a System, dividing space
+ *          into cubic cells so that all the Gaussians near to a point can be found
+ *          without looking at every Gaussian, and the distance beyond which the
+ *          overlap between two Gaussians must be below a threshold.
+ *
+ * CONTAINS:
+ *          class SpatialIndex:
+ *              data:
+ *                  cellSize - the length of the side of each cell
+ *                  origin - the lowest x, y, z of any Gaussian
+ *                  order - the indices of the Gaussians, sorted by cell
+ *                  keys - the (packed) integer coordinates of each occupied cell,
+ *                         in ascending order
+ *                  starts - where each cell's Gaussians begin in order
+ *              routines:
+ *                  getNCells() - the number of occupied cells
+ *                  cellOf(x, y, z, cx, cy, cz) - the integer coordinates of the
+ *                                                cell containing a point
+ *                  findCell(cx, cy, cz) - the index of the cell with the given
+ *                                         integer coordinates, or -1 if empty
+ *                  cellCoords(c, cx, cy, cz) - the integer coordinates of cell c
+ *                  cellBegin(c), cellEnd(c) - the range of order in cell c
+ *                  near(x, y, z, radius, result) - all Gaussians within radius
+ *                                                  of the point (x, y, z)
+ *
+ *          cutoffRadius(sys, threshold) - the largest distance at which any pair of
+ *                                         Gaussians in sys can overlap by at least
+ *                                         threshold
+ *          cutoffRadius(a, b, threshold) - as above, for a Gaussian of a and one of b
+ *          zetaCutoff(a, b, threshold) - as above, for a Gaussian with exponent a
+ *                                        and one with exponent b
+ *          latticeImages(cell, reach, shifts) - all the translations of a periodic
+ *                                               lattice no longer than reach
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 18/10/26     agent            Original code.
+ * 18/10/26     agent            Lattice images.
+ * 18/10/26     agent            Cutoff radius between two systems.
+ * 19/10/26     agent            Cutoff radius between two exponents.
+ *
+ ************************************************************************************/
+
+#ifndef SPATIALHEADERDEF
+#define SPATIALHEADERDEF
+
+#include <vector>
+
+// Declare forward dependencies
+class System;
+
+class SpatialIndex
+{
+private:
+	double cellSize;
+	double origin[3];
+	std::vector<int> order; // Gaussian indices, sorted by cell
+	std::vector<long long> keys; // Packed cell coordinates, ascending
+	std::vector<int> starts; // Start of each cell in order, with starts.back() = N
+
+	static long long pack(int cx, int cy, int cz);
+public:
+	// Build from the first n Gaussians in sys (all of them if n < 0)
+	SpatialIndex(const System& sys, double cellSize_, int n = -1);
+
+	int getNCells() const { return keys.size(); }
+	double getCellSize() const { return cellSize; }
+	const std::vector<int>& getOrder() const { return order; }
+
+	void cellOf(double x, double y, double z, int& cx, int& cy, int& cz) const;
+	int findCell(int cx, int cy, int cz) const;
+	void cellCoords(int c, int& cx, int& cy, int& cz) const;
+	int cellBegin(int c) const { return starts[c]; }
+	int cellEnd(int c) const { return starts[c+1]; }
+
+	// Append to result the indices of all Gaussians within radius of (x, y, z)
+	void near(const System& sys, double x, double y, double z, double radius,
+			  std::vector<int>& result) const;
+};
+
+// Distance beyond which no two Gaussians in sys overlap by threshold or more
+double cutoffRadius(const System& sys, double threshold);
+// Distance beyond which no Gaussian in a overlaps one in b by threshold or more
+double cutoffRadius(const System& a, const System& b, double threshold);
+// Distance beyond which a Gaussian with exponent a and one with exponent b
+// overlap by less than threshold
+double zetaCutoff(double a, double b, double threshold);
+
+// Append to shifts the x, y, z of every lattice translation n1 a1 + n2 a2 + n3 a3
+// of length at most reach, the origin first, where cell holds the lattice
+// vectors a1, a2, a3 in turn (nine values)
+void latticeImages(const std::vector<double>& cell, double reach, std::vector<double>& shifts);
+
+#endif
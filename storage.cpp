@@ -0,0 +1,280 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement the compressed overlap storage, the row cache, and the
+ *          row reader
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ * 18/10/26       agent              Cache of rows calculated on demand.
+ * 19/10/26       agent              Truncation of compressed rows.
+ * 19/10/26       agent              Row cache kept as gaussians are added and removed.
+ * 19/10/26       agent              Quantised integrals zig-zag encoded; uncompressed
+ *                                   rows read in place.
+ *
+ ***************************************************************************************/
+
+#include "storage.hpp"
+#include "system.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+// Decode a variable-length integer, moving p past it
+static inline unsigned long long getVarint(const unsigned char*& p)
+{
+	unsigned long long v = *p & 0x7f;
+	int shift = 7;
+	while (*p++ & 0x80) {
+		v |= (unsigned long long) (*p & 0x7f) << shift;
+		shift += 7;
+	}
+	return v;
+}
+
+// Zig-zag encoding of a signed integer, so that small magnitudes of either sign
+// take few bytes as varints, and its decoding
+static inline unsigned long long zigzag(long long v)
+{
+	return ((unsigned long long) v << 1) ^ (unsigned long long) (v >> 63);
+}
+
+static inline long long unzigzag(unsigned long long v)
+{
+	return (long long) (v >> 1) ^ -(long long) (v & 1);
+}
+
+CompressedRows::CompressedRows(double step_) : step(step_), nonzero(0)
+{
+	offsets.push_back(0);
+}
+
+// Encode a variable-length integer, seven bits at a time, lowest first
+void CompressedRows::putVarint(unsigned long long v)
+{
+	while (v >= 0x80) {
+		bytes.push_back((unsigned char) (v | 0x80));
+		v >>= 7;
+	}
+	bytes.push_back((unsigned char) v);
+}
+
+// Encode a row as its length, first column and column gaps, then the integrals
+void CompressedRows::appendRow(int i, const int* indices, const double* values, int count)
+{
+	int base = 1 + (i*(i+1))/2; // Packed index of (i, 0)
+
+	putVarint(count);
+	int last = -1;
+	for (int k = 0; k < count; k++){
+		int j = indices[k] - base;
+		putVarint(j - last - 1); // Columns are ascending, so the gap is never negative
+		last = j;
+	}
+
+	if (step > 0.0) {
+		for (int k = 0; k < count; k++) putVarint(zigzag(llround(values[k]/step)));
+	} else {
+		std::size_t end = bytes.size();
+		bytes.resize(end + count*sizeof(double));
+		std::memcpy(&bytes[end], values, count*sizeof(double));
+	}
+
+	nonzero += count;
+	offsets.push_back(bytes.size());
+}
+
+// Decode row i into cols and vals, returning its length
+int CompressedRows::decodeRow(int i, std::vector<int>& cols, std::vector<double>& vals) const
+{
+	const unsigned char* p = bytes.data() + offsets[i];
+	int count = getVarint(p);
+	cols.resize(count);
+	vals.resize(count);
+
+	int j = -1;
+	for (int k = 0; k < count; k++){
+		j += getVarint(p) + 1;
+		cols[k] = j;
+	}
+
+	if (step > 0.0) {
+		for (int k = 0; k < count; k++) vals[k] = unzigzag(getVarint(p))*step;
+	} else {
+		std::memcpy(vals.data(), p, count*sizeof(double));
+	}
+	return count;
+}
+
+// Discard the rows from row rows on, counting off their integrals from the
+// length at the start of each
+void CompressedRows::truncate(int rows)
+{
+	int nrows = offsets.size() - 1;
+	if (rows < 0 || rows >= nrows) return;
+	for (int i = rows; i < nrows; i++){
+		const unsigned char* p = bytes.data() + offsets[i];
+		nonzero -= getVarint(p);
+	}
+	bytes.resize(offsets[rows]);
+	offsets.resize(rows + 1);
+}
+
+void CompressedRows::shrink()
+{
+	bytes.shrink_to_fit();
+	offsets.shrink_to_fit();
+}
+
+// Constructor - index the gaussians by cells of the cutoff radius
+RowCache::RowCache(const System& sys, std::size_t capacity_)
+	: cutoff(cutoffRadius(sys, sys.getThreshold())), index(sys, cutoff), indexedN(sys.getN()), capacity(capacity_), used(0), peak(0), computed(sys.getN(), 0), hits(0), misses(0), nComputed(0)
+{
+	for (int i = 0; i < sys.getN(); i++) zetas.push_back(sys.getGaussian(i).getZeta());
+	std::sort(zetas.begin(), zetas.end());
+	zetas.erase(std::unique(zetas.begin(), zetas.end()), zetas.end());
+}
+
+// Add an exponent, if it is new, widening the cutoff to reach every pair
+void RowCache::addZeta(double zeta, double threshold)
+{
+	std::vector<double>::iterator pos = std::lower_bound(zetas.begin(), zetas.end(), zeta);
+	if (pos != zetas.end() && *pos == zeta) return;
+	zetas.insert(pos, zeta);
+	for (int k = 0; k < zetas.size(); k++)
+		cutoff = std::max(cutoff, zetaCutoff(zeta, zetas[k], threshold));
+}
+
+// Make room for the rows of the gaussians added to sys since the last call.
+// The rows before them are unchanged, so are kept; the new gaussians are not
+// in the index, so their rows look at all of them directly.
+void RowCache::grow(const System& sys)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	for (int i = computed.size(); i < sys.getN(); i++) addZeta(sys.getGaussian(i).getZeta(), sys.getThreshold());
+	computed.resize(sys.getN(), 0);
+}
+
+// Forget the rows from row kept on, once the gaussians from kept on have been
+// removed from sys. If any of them were indexed, the index is made again of
+// those left; the cutoff is kept, as it still reaches every pair.
+void RowCache::truncate(const System& sys, int kept)
+{
+	std::lock_guard<std::mutex> guard(lock);
+	if (kept >= computed.size()) return;
+
+	for (std::list<int>::iterator it = recent.begin(); it != recent.end(); ){
+		if (*it < kept) { ++it; continue; }
+		RowMap::iterator found = rows.find(*it);
+		used -= bytes(*found->second.first);
+		rows.erase(found);
+		it = recent.erase(it);
+	}
+	for (int i = kept; i < computed.size(); i++) nComputed -= computed[i];
+	computed.resize(kept);
+
+	if (kept < indexedN) {
+		index = SpatialIndex(sys, index.getCellSize(), kept);
+		indexedN = kept;
+	}
+}
+
+// Approximate memory taken by a cached row
+std::size_t RowCache::bytes(const Row& row)
+{
+	return sizeof(Row) + 64 + row.cols.size()*(sizeof(int) + sizeof(double));
+}
+
+// Calculate row i from the gaussians within the cutoff of gaussian i, and
+// any added since the index was made, as calcOverlap would, so that the
+// integrals are identical
+void RowCache::calculate(const System& sys, int i, Row& row) const
+{
+	const Gaussian& g = sys.getGaussian(i);
+	std::vector<int> near;
+	index.near(sys, g.getCoord(0), g.getCoord(1), g.getCoord(2), cutoff, near);
+	std::sort(near.begin(), near.end());
+	for (int j = indexedN; j <= i; j++) near.push_back(j);
+
+	for (int p = 0; p < near.size() && near[p] <= i; p++){
+		double integral = g.overlap(sys.getGaussian(near[p]));
+		if (integral >= sys.getThreshold()) {
+			row.cols.push_back(near[p]);
+			row.vals.push_back(integral);
+		}
+	}
+}
+
+// Look row i up, and if it is not there, calculate it without holding the
+// lock, so that other rows can be looked up meanwhile. The new row becomes
+// the most recently used, and the least recently used rows are evicted
+// until the cache fits in its capacity again (always keeping the new row).
+RowCache::RowPtr RowCache::get(const System& sys, int i)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		RowMap::iterator found = rows.find(i);
+		if (found != rows.end()) {
+			hits++;
+			recent.splice(recent.begin(), recent, found->second.second);
+			return found->second.first;
+		}
+		misses++;
+	}
+
+	std::shared_ptr<Row> row = std::make_shared<Row>();
+	calculate(sys, i, *row);
+
+	std::lock_guard<std::mutex> guard(lock);
+	if (!computed[i]) { computed[i] = 1; nComputed++; }
+
+	// Another thread may have calculated it meanwhile
+	RowMap::iterator found = rows.find(i);
+	if (found != rows.end()) return found->second.first;
+
+	recent.push_front(i);
+	rows[i] = std::make_pair(RowPtr(row), recent.begin());
+	used += bytes(*row);
+	peak = std::max(peak, used);
+
+	while (used > capacity && recent.size() > 1) {
+		RowMap::iterator evicted = rows.find(recent.back());
+		used -= bytes(*evicted->second.first);
+		rows.erase(evicted);
+		recent.pop_back();
+	}
+	return row;
+}
+
+RowReader::RowReader(const System& sys_) : sys(sys_), keys(0), base(0), vals(0)
+{
+}
+
+// Read row i, from the row cache if the rows are calculated on demand,
+// decoding it if compressed, or otherwise pointing straight at sInts and
+// sIndices, whose packed indices are the columns plus that of (i, 0)
+int RowReader::read(int i)
+{
+	if (RowCache* cache = sys.getRowCache()) {
+		cached = cache->get(sys, i);
+		keys = cached->cols.data();
+		base = 0;
+		vals = cached->vals.data();
+		return cached->cols.size();
+	}
+
+	const CompressedRows* compressed = sys.getCompressed();
+	if (compressed) {
+		int count = compressed->decodeRow(i, colBuffer, valBuffer);
+		keys = colBuffer.data();
+		base = 0;
+		vals = valBuffer.data();
+		return count;
+	}
+
+	int start = sys.sRowStart[i];
+	keys = sys.sIndices.data() + start;
+	base = 1 + (i*(i+1))/2;
+	vals = sys.sInts.data() + start;
+	return sys.sRowStart[i+1] - start;
+}
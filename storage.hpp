@@ -0,0 +1,174 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To provide a compressed store for the non-zero overlap integrals of a
+ *          System, a cache of rows calculated only when they are first needed,
+ *          and a reader that streams the rows of the lower triangle of the
+ *          overlap matrix however they are stored.
+ *
+ *          Uncompressed, each integral costs a double and an int (its packed index).
+ *          Compressed, each row is stored as its number of integrals, then its
+ *          columns as the first column and the gaps between consecutive columns,
+ *          and then its integrals, all as variable-length (LEB128) integers, where
+ *          each byte holds seven bits, and its top bit is set if more follow. On
+ *          spatially sorted inputs the gaps are small, so most take a single byte.
+ *          The integrals are either stored exactly, as doubles, or quantised to
+ *          integer multiples of a step, with an error of at most half the step;
+ *          the multiples are zig-zag encoded (0, -1, 1, -2, ... as 0, 1, 2, 3, ...),
+ *          so that negative integrals are as small as positive ones.
+ *
+ * CONTAINS:
+ *          class CompressedRows:
+ *              data:
+ *                  step - the quantisation step, or zero to store exact values
+ *                  bytes - the encoded rows
+ *                  offsets - where each row starts in bytes
+ *              routines:
+ *                  appendRow(i, indices, values, count) - encode the next row, i,
+ *                                       from packed indices and their integrals
+ *                  decodeRow(i, cols, vals) - decode row i, returning its length
+ *                  truncate(rows) - discard every row after the first rows
+ *                  getNonZero() - the number of integrals stored
+ *                  storage() - the number of bytes used
+ *
+ *          class RowCache:
+ *              data:
+ *                  index - a spatial index of the first indexedN gaussians, with
+ *                          cells of the cutoff radius, so that each row is
+ *                          calculated from only the gaussians near enough to
+ *                          overlap, and those added since the index was made
+ *                  zetas - the distinct exponents of the gaussians, which the
+ *                          cutoff radius is the largest over the pairs of
+ *                  rows - the cached rows, and where each is in recent
+ *                  recent - the cached rows, most recently used first
+ *                  capacity - the most bytes of rows to keep; the least recently
+ *                             used rows are evicted beyond this
+ *              routines:
+ *                  get(sys, i) - row i, from the cache if there, or calculated
+ *                  getHits(), getMisses() - requests found in, or not in, the cache
+ *                  getComputed() - the number of distinct rows ever calculated
+ *                  getPeak() - the most bytes of rows held at once
+ *                  grow(sys) - make room for the rows of gaussians added to sys
+ *                  truncate(sys, kept) - forget every row after the first kept,
+ *                                        once the gaussians after them are removed
+ *              All routines are thread safe, but grow and truncate must not be
+ *              called while rows are being read; rows are handed out as shared
+ *              pointers, so remain valid for their users after eviction.
+ *
+ *          class RowReader:
+ *              routines:
+ *                  read(i) - make row i available as vals and col(k), returning its
+ *                            length; uncompressed or cached rows are not copied, the
+ *                            columns of uncompressed rows being found from their
+ *                            packed indices as they are asked for
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 18/10/26     agent            Original code.
+ * 18/10/26     agent            Cache of rows calculated on demand.
+ * 19/10/26     agent            Truncation of compressed rows.
+ * 19/10/26     agent            Row cache kept as gaussians are added and removed.
+ * 19/10/26     agent            Quantised integrals zig-zag encoded; uncompressed
+ *                               rows read without copying their columns.
+ *
+ ************************************************************************************/
+
+#ifndef STORAGEHEADERDEF
+#define STORAGEHEADERDEF
+
+#include "spatial.hpp"
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+
+// Declare forward dependencies
+class System;
+
+class CompressedRows
+{
+private:
+	double step; // Quantisation step, zero for exact values
+	std::vector<unsigned char> bytes; // The encoded rows
+	std::vector<long long> offsets; // Start of each row, with offsets.back() = bytes.size()
+	long long nonzero;
+
+	void putVarint(unsigned long long v);
+public:
+	CompressedRows(double step_ = 0.0);
+
+	// Rows must be appended in order, starting from row 0
+	void appendRow(int i, const int* indices, const double* values, int count);
+	int decodeRow(int i, std::vector<int>& cols, std::vector<double>& vals) const;
+	void truncate(int rows); // So that rows can be appended again from row rows
+
+	double getStep() const { return step; }
+	long long getNonZero() const { return nonzero; }
+	std::size_t storage() const { return bytes.size() + offsets.size()*sizeof(long long); }
+	void shrink(); // Free any spare capacity, once all rows are appended
+};
+
+class RowCache
+{
+public:
+	// The columns (ascending) and integrals of a row of the lower triangle
+	struct Row {
+		std::vector<int> cols;
+		std::vector<double> vals;
+	};
+private:
+	typedef std::shared_ptr<const Row> RowPtr;
+	typedef std::unordered_map<int, std::pair<RowPtr, std::list<int>::iterator> > RowMap;
+
+	double cutoff; // Beyond which no integral is above the threshold
+	SpatialIndex index;
+	int indexedN; // Gaussians in index
+	std::vector<double> zetas; // Distinct exponents, ascending
+	std::size_t capacity, used, peak; // In bytes
+	RowMap rows;
+	std::list<int> recent;
+	std::vector<char> computed; // Whether each row has ever been calculated
+	long long hits, misses, nComputed;
+	std::mutex lock;
+
+	static std::size_t bytes(const Row& row);
+	void calculate(const System& sys, int i, Row& row) const;
+	void addZeta(double zeta, double threshold);
+public:
+	// The cache of the rows of sys, holding at most capacity_ bytes of rows
+	RowCache(const System& sys, std::size_t capacity_);
+
+	RowPtr get(const System& sys, int i);
+
+	void grow(const System& sys);
+	void truncate(const System& sys, int kept);
+
+	long long getHits() const { return hits; }
+	long long getMisses() const { return misses; }
+	long long getComputed() const { return nComputed; }
+	std::size_t getCapacity() const { return capacity; }
+	std::size_t getPeak() const { return peak; }
+};
+
+class RowReader
+{
+private:
+	const System& sys;
+	std::vector<int> colBuffer;
+	std::vector<double> valBuffer;
+	std::shared_ptr<const RowCache::Row> cached; // Keeps a cached row alive while read
+	const int* keys; // Columns, or uncompressed, packed indices
+	int base; // Subtracted from keys to give columns
+public:
+	RowReader(const System& sys_);
+
+	// The integrals of the last row read, and the column (ascending) of
+	// vals[k], valid until the next read
+	const double* vals;
+	int col(int k) const { return keys[k] - base; }
+
+	int read(int i);
+};
+
+#endif
@@ -5,53 +5,768 @@
  * DATE           AUTHOR             CHANGES
  * ======================================================================
  * 18/12/15       Robert Shaw        Original code.
+ * 18/10/26       agent              Factorisation cache added.
+ * 18/10/26       agent              Row starts of the packed integrals stored.
+ * 18/10/26       agent              Threshold sweep histogram.
+ * 18/10/26       agent              Sharded calcOverlap over worker processes.
+ * 18/10/26       agent              Compressed storage of the integrals.
+ * 18/10/26       agent              Gradient of the integrals.
+ * 18/10/26       agent              Periodic lattice sums.
+ * 18/10/26       agent              Copies keep the integrals; move operations.
+ * 18/10/26       agent              Lazy rows, with a row cache.
+ * 19/10/26       agent              Spatially screened rows.
+ * 19/10/26       agent              Gaussians added and removed after calcOverlap.
+ * 19/10/26       agent              Periodic search made once per calcOverlap.
+ * 19/10/26       agent              Screened search made once; blocks of expected integrals.
+ * 19/10/26       agent              Search and row cache kept as gaussians are added and removed.
  *
  ***************************************************************************************/
 
 #include "system.hpp"
+#include "factorise.hpp"
+#include "storage.hpp"
+#include "spatial.hpp"
 #include <iostream>
+#include <algorithm>
+#include <utility>
+#include <cmath>
+#include <cstdlib>
+#include <cstdio>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+// Number of integrals calculated at a time, when they are passed on a block
+// at a time (by a worker to its spill file, or to be compressed)
+const int ROW_BLOCK = 1 << 20;
+
+// The integrals expected in row i: all i+1 pairs, unless the rows are
+// found from a spatial index, with about perRow (> 0) pairs in each
+static double rowCost(int i, double perRow)
+{
+	return (perRow > 0.0 ? std::min(i + 1.0, perRow) : i + 1.0);
+}
+
+// The end of a block of rows starting at first, and ending by last, with
+// enough rows to make up (about) ROW_BLOCK integrals
+static int blockEnd(int first, int last, double perRow)
+{
+	int end = first;
+	double pairs = 0.0;
+	while (end < last && (end == first || pairs + rowCost(end, perRow) <= ROW_BLOCK))
+		pairs += rowCost(end++, perRow);
+	return end;
+}
 
 // Constructor
-System::System(double THRESHOLD_) : N(0), zeroes(0), THRESHOLD(THRESHOLD_)
+System::System(double THRESHOLD_) : N(0), zeroes(0), THRESHOLD(THRESHOLD_), nShards(1),
+									compress(false), quantise(0.0), gradient(false),
+									lazy(false), cacheSize(64.0), screen(false),
+									factors(std::make_shared<FactorCache>())
 {
 }
 
-// Add a Gaussian
+// Add a Gaussian, and its row if the overlap has already been calculated
 void System::addGaussian(Gaussian g_)
 {
+	bool grow = hasRows();
 	gaussians.push_back(g_);
 	N += 1;
+	if (grow) growRow();
+}
+
+// Calculate the row of the last gaussian, added after calcOverlap, and append it.
+// The rows before it are unchanged, so are the cached factorisations of up to N-1
+// functions. The row is found from the kept search, made the first time it is
+// needed, looking at the indexed gaussians near the new one, and every gaussian
+// added since; its histogram counts are recorded, for rollback. A lazy System
+// keeps its row cache, which calculates the new row when it is first read.
+void System::growRow()
+{
+	int i = N - 1;
+	factors = factors->leading(i);
+	if (rowCache) {
+		// Copies share the row cache, so this System makes its own before changing it
+		if (rowCache.use_count() > 1)
+			rowCache = std::make_shared<RowCache>(*this, (std::size_t) (cacheSize*1024.0*1024.0));
+		else rowCache->grow(*this);
+		return;
+	}
+
+	if (grown.indexedN < 0) grown = makeSearch(i, true);
+	searchZeta(grown, gaussians[i].getZeta());
+	if (isPeriodic()) searchBox(grown, i, i+1);
+
+	std::vector<double> ints, grads;
+	std::vector<int> indices, rowStart;
+	std::vector<long long> counts(sweepCounts.size(), 0);
+	if (isPeriodic()) periodicRows(i, i+1, grown, ints, indices, rowStart, zeroes, counts, grads);
+	else screenedRows(i, i+1, grown, ints, indices, rowStart, zeroes, counts, grads);
+	for (int b = 0; b < counts.size(); b++) sweepCounts[b] += counts[b];
+	grownCounts.insert(grownCounts.end(), counts.begin(), counts.end());
+
+	// Copies share compressed rows, so this System takes its own before changing them
+	if (compressed && compressed.use_count() > 1)
+		compressed = std::make_shared<CompressedRows>(*compressed);
+	sRowStart.pop_back(); // The final row start, added again after the new row
+	storeRows(i, ints, indices, rowStart, grads);
+	sRowStart.push_back(compressed ? compressed->getNonZero() : (long long) sInts.size());
+}
+
+// Remove the gaussians from mark on, and their rows. The zeroes in the rows
+// left are all the pairs in them less their integrals. The histogram counts
+// of the rows removed were recorded when they were added; any calculated by
+// calcOverlap are found by calculating them again. The search is kept, with
+// the exponents of the gaussians left, unless gaussians it indexes are removed,
+// and a row cache only forgets the rows removed.
+void System::rollback(int mark)
+{
+	if (mark < 0) mark = 0;
+	if (mark >= N) return;
+
+	if (hasOverlap()) {
+		if (!sweepCounts.empty()) {
+			int bins = sweepCounts.size();
+			int recorded = (grown.indexedN >= 0 ? grown.indexedN : N); // First row with counts recorded
+			if (mark < recorded) {
+				std::vector<double> ints, grads;
+				std::vector<int> indices, rowStart;
+				std::vector<long long> removed(bins, 0);
+				int removedZeroes = 0;
+				overlapRows(mark, recorded, makeSearch(recorded), ints, indices, rowStart,
+							removedZeroes, removed, grads);
+				for (int b = 0; b < bins; b++) sweepCounts[b] -= removed[b];
+			}
+			for (int r = std::max(mark, recorded); r < N; r++)
+				for (int b = 0; b < bins; b++) sweepCounts[b] -= grownCounts[(std::size_t) (r - recorded)*bins + b];
+		}
+
+		long long kept = sRowStart[mark];
+		if (compressed) {
+			if (compressed.use_count() > 1) compressed = std::make_shared<CompressedRows>(*compressed);
+			compressed->truncate(mark);
+		} else {
+			sInts.resize(kept);
+			sIndices.resize(kept);
+		}
+		if (sGrads.size() > 3*kept) sGrads.resize(3*kept);
+		sRowStart.resize(mark + 1);
+		zeroes = ((long long) mark*(mark+1))/2 - kept;
+	}
+
+	gaussians.erase(gaussians.begin() + mark, gaussians.end());
+	N = mark;
+	factors = factors->leading(mark);
+	if (rowCache) {
+		if (rowCache.use_count() > 1)
+			rowCache = std::make_shared<RowCache>(*this, (std::size_t) (cacheSize*1024.0*1024.0));
+		else rowCache->truncate(*this, mark);
+	}
+
+	if (grown.indexedN > mark) {
+		grown = RowSearch();
+		grownCounts.clear();
+	} else if (grown.indexedN >= 0) {
+		grownCounts.resize((std::size_t) (mark - grown.indexedN)*sweepCounts.size());
+		grown.zetas.clear();
+		grown.cutoff = 0.0;
+		for (int k = 0; k < grown.indexedZetas.size(); k++) searchZeta(grown, grown.indexedZetas[k]);
+		for (int j = grown.indexedN; j < mark; j++) searchZeta(grown, gaussians[j].getZeta());
+	}
 }
 
 // Calculate the overlap integrals
 void System::calcOverlap()
 {
-	double currentIntegral;
+	// Start afresh, discarding any previous integrals, any cached
+	// factorisations of the old overlap matrix, and any search kept
+	factors = std::make_shared<FactorCache>();
+	grown = RowSearch();
+	grownCounts.clear();
+	sweepCounts.assign(sweepThresholds.size() + (sweepThresholds.empty() ? 0 : 1), 0);
+	clearOverlap();
+
+	// Lazy rows are found from the gaussians near to each, so can only be
+	// used when every pair need not be looked at (as for a sweep), and
+	// nothing but the integrals is wanted
+	if (lazy && (isPeriodic() || gradient || !sweepThresholds.empty())) {
+		std::cerr << "Rows cannot be calculated lazily for periodic systems, gradients,\n"
+				  << "or threshold sweeps. Calculating the whole overlap instead.\n";
+		lazy = false;
+	}
+	if (lazy) {
+		rowCache = std::make_shared<RowCache>(*this, (std::size_t) (cacheSize*1024.0*1024.0));
+		return;
+	}
+
+	// The index (and lattice images) are made once, before any workers are forked,
+	// and kept for the rows of any gaussians added later
+	RowSearch search = makeSearch(N);
+	if (search.index) grown = search;
+
+	if (nShards > 1 && N > 1) {
+		if (calcOverlapSharded(search)) return;
+		nShards = 1; // Sharding failed, so is not tried again
+	}
+
+	// Serially, if not sharded (or if sharding failed)
+	clearOverlap();
+	if (!compress) {
+		overlapRows(0, N, search, sInts, sIndices, sRowStart, zeroes, sweepCounts, sGrads);
+		sRowStart.push_back(sInts.size());
+	} else {
+		// Compress a block of rows at a time, so that the
+		// uncompressed integrals are never all held at once
+		std::vector<double> ints, grads;
+		std::vector<int> indices, rowStart;
+		for (int first = 0; first < N; ){
+			int last = blockEnd(first, N, search.perRow);
+			ints.clear(); indices.clear(); rowStart.clear(); grads.clear();
+			overlapRows(first, last, search, ints, indices, rowStart, zeroes, sweepCounts, grads);
+			storeRows(first, ints, indices, rowStart, grads);
+			first = last;
+		}
+		finishOverlap();
+	}
+}
+
+// Discard any integrals, zeroes, and histogram counts
+void System::clearOverlap()
+{
+	zeroes = 0;
+	std::vector<double>().swap(sInts);
+	std::vector<int>().swap(sIndices);
+	std::vector<double>().swap(sGrads);
+	rowCache.reset();
+	sRowStart.clear();
+	sweepCounts.assign(sweepCounts.size(), 0);
+	if (compress) compressed = std::make_shared<CompressedRows>(2.0*quantise*THRESHOLD);
+	else compressed.reset();
+}
+
+// Store a block of rows, starting at row first, given their integrals, packed
+// indices, where each row starts in them, and their gradients (if wanted),
+// compressing the integrals if wanted
+void System::storeRows(int first, const std::vector<double>& ints, const std::vector<int>& indices,
+					   const std::vector<int>& rowStart, const std::vector<double>& grads)
+{
+	int rows = rowStart.size();
+	sGrads.insert(sGrads.end(), grads.begin(), grads.end());
+	if (!compress) {
+		int base = sInts.size();
+		for (int r = 0; r < rows; r++) sRowStart.push_back(base + rowStart[r]);
+		sInts.insert(sInts.end(), ints.begin(), ints.end());
+		sIndices.insert(sIndices.end(), indices.begin(), indices.end());
+	} else {
+		for (int r = 0; r < rows; r++){
+			int end = (r+1 < rows ? rowStart[r+1] : (int) ints.size());
+			sRowStart.push_back(compressed->getNonZero());
+			compressed->appendRow(first + r, indices.data() + rowStart[r], ints.data() + rowStart[r],
+								  end - rowStart[r]);
+		}
+	}
+}
+
+// Add the final row start, once all the rows are stored
+void System::finishOverlap()
+{
+	if (compress) {
+		sRowStart.push_back(compressed->getNonZero());
+		compressed->shrink();
+		sGrads.shrink_to_fit();
+	} else {
+		sRowStart.push_back(sInts.size());
+	}
+}
+
+// Number of non-zero integrals stored
+long long System::getNonZero() const
+{
+	return (compressed ? compressed->getNonZero() : (long long) sInts.size());
+}
+
+// Bytes used to store the non-zero integrals, including the row starts
+double System::storage() const
+{
+	double bytes = sRowStart.size()*sizeof(int);
+	if (compressed) bytes += compressed->storage();
+	else bytes += sInts.size()*sizeof(double) + sIndices.size()*sizeof(int);
+	return bytes;
+}
+
+// Set whether rows are calculated lazily, and the size of their cache
+void System::setLazy(bool lazy_, double megabytes)
+{
+	lazy = lazy_;
+	cacheSize = (megabytes > 0.0 ? megabytes : 64.0);
+}
+
+// Set whether the integrals are compressed, and if so, whether they are
+// quantised, with an error of at most quantise_ * THRESHOLD (none if zero)
+void System::setCompression(bool compress_, double quantise_)
+{
+	compress = compress_;
+	quantise = (quantise_ > 0.0 ? quantise_ : 0.0);
+}
+
+// Calculate rows first to last-1 of the lower triangle of the overlap matrix,
+// appending the non-zero integrals, their indices, the row starts, and (if
+// wanted) their gradients, and adding to the count of zeroes and the sweep
+// histogram. The gradient is screened with the integral, so has the same
+// sparsity pattern.
+void System::overlapRows(int first, int last, const RowSearch& search, std::vector<double>& ints,
+						 std::vector<int>& indices, std::vector<int>& rowStart, int& nzeroes,
+						 std::vector<long long>& counts, std::vector<double>& grads) const
+{
+	if (isPeriodic()) {
+		periodicRows(first, last, search, ints, indices, rowStart, nzeroes, counts, grads);
+		return;
+	}
+	if (screen) {
+		screenedRows(first, last, search, ints, indices, rowStart, nzeroes, counts, grads);
+		return;
+	}
+
+	double currentIntegral, currentGrad[3];
 	int currentIndex;
+	bool sweeping = !sweepThresholds.empty();
 	
 	// Loop over all unique pairs of Gaussians
 	// (the overlap matrix is necessarily real, symmetric, positive definite)
 	// i=j should give an overlap of 1 
-	for (int i = 0; i < N; i++){
+	for (int i = first; i < last; i++){
+		rowStart.push_back(ints.size());
 		for (int j = 0; j < i+1; j++){
 
-			// Calculate integral
-			currentIntegral = gaussians[i].overlap(gaussians[j]);
+			// Calculate integral, and its gradient if wanted
+			if (gradient) currentIntegral = gaussians[i].overlap(gaussians[j], currentGrad);
+			else currentIntegral = gaussians[i].overlap(gaussians[j]);
+
+			// Add it to the histogram, in the bin given by the
+			// number of sweep thresholds it is at or above
+			if (sweeping)
+				counts[std::upper_bound(sweepThresholds.begin(), sweepThresholds.end(),
+										currentIntegral) - sweepThresholds.begin()]++;
 
 			// Check if lower than threshold
-			if (currentIntegral < THRESHOLD) zeroes+=1;
+			if (currentIntegral < THRESHOLD) nzeroes+=1;
 			else {
 				// Push the non-zero integral into the vector of overlap integrals
-				sInts.push_back(currentIntegral);
+				ints.push_back(currentIntegral);
 
 				// Determine the correct matrix index given our packing system
 				currentIndex = 1 + j + ( i*(i+1) )/2;
-				sIndices.push_back(currentIndex);
+				indices.push_back(currentIndex);
+
+				if (gradient) grads.insert(grads.end(), currentGrad, currentGrad + 3);
+			}
+		}
+	}
+}
+
+// Make the search for the rows, if they are screened or periodic (or always): a
+// spatial index of the first n gaussians, with cells of the cutoff radius for the
+// smallest threshold wanted (THRESHOLD, or the lowest sweep threshold), and the
+// number of pairs each row is expected to look at, from the gaussians in the cells
+// around each. If periodic, also the box around the gaussians, and the lattice
+// translations that could bring any pair of them within the cutoff. Otherwise,
+// nothing is searched.
+System::RowSearch System::makeSearch(int n, bool always) const
+{
+	RowSearch search;
+	search.indexedN = n;
+	if (!(always || screen || isPeriodic()) || n == 0) return search;
+
+	for (int i = 0; i < n; i++) searchZeta(search, gaussians[i].getZeta());
+	search.indexedZetas = search.zetas;
+	search.index = std::make_shared<SpatialIndex>(*this, (search.cutoff > 0.0 ? search.cutoff : 1.0), n);
+
+	// Half the gaussians around each (those before it in the lower triangle), and itself
+	const SpatialIndex& index = *search.index;
+	double around = 0.0;
+	for (int c = 0; c < index.getNCells(); c++){
+		int cx, cy, cz, nearby = 0;
+		index.cellCoords(c, cx, cy, cz);
+		for (int dx = -1; dx <= 1; dx++)
+			for (int dy = -1; dy <= 1; dy++)
+				for (int dz = -1; dz <= 1; dz++){
+					int d = index.findCell(cx + dx, cy + dy, cz + dz);
+					if (d >= 0) nearby += index.cellEnd(d) - index.cellBegin(d);
+				}
+		around += (double) (index.cellEnd(c) - index.cellBegin(c))*nearby;
+	}
+	search.perRow = 0.5*around/n + 1.0;
+
+	if (isPeriodic()) searchBox(search, 0, n);
+	return search;
+}
+
+// Add an exponent to those of a search, if it is new, widening the cutoff radius
+// to the largest over all the pairs of them, as cutoffRadius finds it
+void System::searchZeta(RowSearch& search, double zeta) const
+{
+	std::vector<double>::iterator pos = std::lower_bound(search.zetas.begin(), search.zetas.end(), zeta);
+	if (pos != search.zetas.end() && *pos == zeta) return;
+	search.zetas.insert(pos, zeta);
+
+	double limit = screenThreshold();
+	for (int k = 0; k < search.zetas.size(); k++)
+		search.cutoff = std::max(search.cutoff, zetaCutoff(zeta, search.zetas[k], limit));
+}
+
+// Widen the box of a periodic search to hold gaussians first to last-1, and find
+// the lattice translations again if they no longer reach across it, and the cutoff
+void System::searchBox(RowSearch& search, int first, int last) const
+{
+	if (first >= last) return;
+	if (search.shifts.empty())
+		for (int k = 0; k < 3; k++) search.lo[k] = search.hi[k] = gaussians[first].getCoord(k);
+
+	double diagonal = 0.0;
+	for (int k = 0; k < 3; k++){
+		for (int i = first; i < last; i++){
+			search.lo[k] = std::min(search.lo[k], gaussians[i].getCoord(k));
+			search.hi[k] = std::max(search.hi[k], gaussians[i].getCoord(k));
+		}
+		diagonal += (search.hi[k] - search.lo[k])*(search.hi[k] - search.lo[k]);
+	}
+
+	double reach = search.cutoff + sqrt(diagonal);
+	if (search.shifts.empty() || reach > search.reach) {
+		search.shifts.clear();
+		latticeImages(cell, reach, search.shifts);
+		search.reach = reach;
+	}
+}
+
+// Calculate rows first to last-1 of a periodic overlap matrix, as overlapRows.
+// Translated overlaps are screened by the cutoff radius of the search, so all
+// those that count are found by searching its spatial index around each image
+// of gaussian i that lies within the cutoff of the gaussians at all (and the
+// gaussians added since the index was made directly); every other
+// pair is a zero, and is never looked at. Gaussian i translated by -L is used in
+// place of gaussian j translated by L, as their overlaps (and gradients with
+// respect to i) are the same.
+void System::periodicRows(int first, int last, const RowSearch& search, std::vector<double>& ints,
+						  std::vector<int>& indices, std::vector<int>& rowStart, int& nzeroes,
+						  std::vector<long long>& counts, std::vector<double>& grads) const
+{
+	if (first >= last) return;
+
+	bool sweeping = !sweepThresholds.empty();
+	double cutoff = search.cutoff, r2 = cutoff*cutoff;
+	const double* lo = search.lo;
+	const double* hi = search.hi;
+	const std::vector<double>& shifts = search.shifts;
+	int nshifts = shifts.size()/3;
+
+	// Sums over the images for the current row, and which columns they are in
+	std::vector<double> sums(N, 0.0), sumGrads(gradient ? 3*N : 0, 0.0);
+	std::vector<char> seen(N, 0);
+	std::vector<int> touched, found;
+	double x[3], currentIntegral, currentGrad[3];
+
+	for (int i = first; i < last; i++){
+		rowStart.push_back(ints.size());
+		touched.clear();
+
+		for (int s = 0; s < nshifts; s++){
+			bool inBox = true;
+			for (int k = 0; k < 3; k++){
+				x[k] = gaussians[i].getCoord(k) - shifts[3*s+k];
+				if (x[k] < lo[k] - cutoff || x[k] > hi[k] + cutoff) inBox = false;
+			}
+			if (!inBox) continue;
+
+			// The indexed gaussians near the image, and those added since within the cutoff
+			found.clear();
+			if (search.index) search.index->near(*this, x[0], x[1], x[2], cutoff, found);
+			for (int j = search.indexedN; j <= i; j++){
+				double ex = gaussians[j].getCoord(0) - x[0], ey = gaussians[j].getCoord(1) - x[1];
+				double ez = gaussians[j].getCoord(2) - x[2];
+				if (ex*ex + ey*ey + ez*ez <= r2) found.push_back(j);
+			}
+			if (found.empty()) continue;
+
+			Gaussian image(gaussians[i].getZeta(), x[0], x[1], x[2]);
+			for (int p = 0; p < found.size(); p++){
+				int j = found[p];
+				if (j > i) continue;
+
+				if (gradient) {
+					currentIntegral = image.overlap(gaussians[j], currentGrad);
+					for (int k = 0; k < 3; k++) sumGrads[3*j+k] += currentGrad[k];
+				} else currentIntegral = image.overlap(gaussians[j]);
+
+				if (!seen[j]) { seen[j] = 1; touched.push_back(j); }
+				sums[j] += currentIntegral;
 			}
 		}
+
+		// Store the sums in column order, clearing them for the next row
+		std::sort(touched.begin(), touched.end());
+		int kept = 0;
+		for (int t = 0; t < touched.size(); t++){
+			int j = touched[t];
+			currentIntegral = sums[j];
+
+			if (sweeping)
+				counts[std::upper_bound(sweepThresholds.begin(), sweepThresholds.end(),
+										currentIntegral) - sweepThresholds.begin()]++;
+
+			if (currentIntegral >= THRESHOLD) {
+				ints.push_back(currentIntegral);
+				indices.push_back(1 + j + ( i*(i+1) )/2);
+				if (gradient) grads.insert(grads.end(), &sumGrads[3*j], &sumGrads[3*j] + 3);
+				kept++;
+			}
+
+			sums[j] = 0.0;
+			seen[j] = 0;
+			if (gradient) for (int k = 0; k < 3; k++) sumGrads[3*j+k] = 0.0;
+		}
+
+		// Pairs never within the cutoff are below every threshold
+		nzeroes += i + 1 - kept;
+		if (sweeping) counts[0] += i + 1 - (int) touched.size();
 	}
 }
 
+// Calculate rows first to last-1 of the overlap matrix of an isolated cluster, as
+// overlapRows, but only for the pairs within the cutoff radius of the search of
+// each other, found by searching its spatial index around each gaussian i (and
+// all the pairs with gaussians added since the index was made). Every
+// other pair is below every threshold, so is counted as a zero (and in the lowest
+// bin of the histogram) without being calculated.
+void System::screenedRows(int first, int last, const RowSearch& search, std::vector<double>& ints,
+						  std::vector<int>& indices, std::vector<int>& rowStart, int& nzeroes,
+						  std::vector<long long>& counts, std::vector<double>& grads) const
+{
+	if (first >= last) return;
+
+	double cutoff = search.cutoff;
+
+	// The indexed gaussians near each, then every one added since
+	std::vector<int> found;
+	for (int i = first; i < last; i++){
+		rowStart.push_back(ints.size());
+		const Gaussian& g = gaussians[i];
+		found.clear();
+		if (search.index) search.index->near(*this, g.getCoord(0), g.getCoord(1), g.getCoord(2), cutoff, found);
+		std::sort(found.begin(), found.end());
+		for (int j = search.indexedN; j <= i; j++) found.push_back(j);
+		candidateRow(i, found, ints, indices, nzeroes, counts, grads);
+	}
+}
+
+// Calculate row i from the candidates (in ascending order) for its non-zero
+// integrals, as overlapRows, appending them; the pairs with any gaussian not
+// among the candidates, or after gaussian i, are counted as zeroes
+void System::candidateRow(int i, const std::vector<int>& candidates, std::vector<double>& ints,
+						  std::vector<int>& indices, int& nzeroes, std::vector<long long>& counts,
+						  std::vector<double>& grads) const
+{
+	bool sweeping = !sweepThresholds.empty();
+	const Gaussian& g = gaussians[i];
+	double currentIntegral, currentGrad[3];
+	int visited = 0, kept = 0;
+	for (int p = 0; p < candidates.size() && candidates[p] <= i; p++){
+		int j = candidates[p];
+		visited++;
+
+		if (gradient) currentIntegral = g.overlap(gaussians[j], currentGrad);
+		else currentIntegral = g.overlap(gaussians[j]);
+
+		if (sweeping)
+			counts[std::upper_bound(sweepThresholds.begin(), sweepThresholds.end(),
+									currentIntegral) - sweepThresholds.begin()]++;
+
+		if (currentIntegral >= THRESHOLD) {
+			ints.push_back(currentIntegral);
+			indices.push_back(1 + j + ( i*(i+1) )/2);
+			if (gradient) grads.insert(grads.end(), currentGrad, currentGrad + 3);
+			kept++;
+		}
+	}
+
+	nzeroes += i + 1 - kept;
+	if (sweeping) counts[0] += i + 1 - visited;
+}
+
+// The smallest threshold any integral is wanted at, i.e. THRESHOLD, or the
+// lowest sweep threshold if lower, which is what the cutoff radius is for
+double System::screenThreshold() const
+{
+	if (sweepThresholds.empty()) return THRESHOLD;
+	return std::min(THRESHOLD, sweepThresholds.front());
+}
+
+// Make the system periodic, if the lattice vectors span space,
+// i.e. enclose a volume that is not negligible
+bool System::setCell(const std::vector<double>& vectors)
+{
+	if (vectors.empty()) {
+		cell.clear();
+		return true;
+	}
+	if (vectors.size() != 9) return false;
+
+	const double* a = vectors.data();
+	double volume = a[0]*(a[4]*a[8] - a[5]*a[7]) - a[1]*(a[3]*a[8] - a[5]*a[6])
+		+ a[2]*(a[3]*a[7] - a[4]*a[6]);
+	double lengths = 1.0;
+	for (int k = 0; k < 3; k++)
+		lengths *= sqrt(a[3*k]*a[3*k] + a[3*k+1]*a[3*k+1] + a[3*k+2]*a[3*k+2]);
+	if (!(fabs(volume) > 1e-10*lengths)) return false;
+
+	cell = vectors;
+	return true;
+}
+
+// Write, or read, exactly bytes to or from a file descriptor
+static bool writeAll(int fd, const void* data, std::size_t bytes)
+{
+	const char* p = static_cast<const char*>(data);
+	while (bytes > 0) {
+		ssize_t done = write(fd, p, bytes);
+		if (done <= 0) return false;
+		p += done; bytes -= done;
+	}
+	return true;
+}
+
+static bool readAll(int fd, void* data, std::size_t bytes)
+{
+	char* p = static_cast<char*>(data);
+	while (bytes > 0) {
+		ssize_t done = read(fd, p, bytes);
+		if (done <= 0) return false;
+		p += done; bytes -= done;
+	}
+	return true;
+}
+
+// Calculate the overlap integrals in nShards worker processes, each doing a
+// range of rows with (roughly) equal numbers of integrals. Each worker writes
+// its integrals to its own spill file, a block of rows at a time, as
+//      { first row, number of rows, number of integrals }, row starts, sInts, sIndices,
+//      and sGrads (if the gradient is wanted)
+// followed by { -1, 0, 0 }, its number of zeroes, and its sweep histogram.
+// The spill files are unlinked as soon as they are created, so are cleaned up
+// however the program ends. The coordinator stitches the shards together in
+// order, each as soon as its worker has finished (compressing them, if wanted,
+// a block at a time). Returns false if any worker could not be started or
+// failed, in which case nothing has been stored.
+bool System::calcOverlapSharded(const RowSearch& search)
+{
+	int nworkers = std::min(nShards, N);
+
+	// Shard k starts at the row by which k/nworkers of the integrals expected
+	// are done; without an index, row i has i+1, so this is row N sqrt(k/nworkers)
+	double total = 0.0;
+	for (int i = 0; i < N; i++) total += rowCost(i, search.perRow);
+	std::vector<int> bounds(nworkers + 1, N);
+	bounds[0] = 0;
+	double done = 0.0;
+	for (int i = 0, k = 1; i < N && k < nworkers; i++){
+		done += rowCost(i, search.perRow);
+		while (k < nworkers && done >= total*k/nworkers) bounds[k++] = i + 1;
+	}
+
+	std::string dir = (getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp");
+	std::vector<int> files(nworkers, -1);
+	std::vector<pid_t> workers(nworkers, -1);
+	bool ok = true;
+
+	// Output buffered before the fork would otherwise be written by every worker
+	std::cout.flush(); std::cerr.flush(); fflush(NULL);
+
+	for (int k = 0; k < nworkers && ok; k++){
+		std::string name = dir + "/overlap_shard_XXXXXX";
+		std::vector<char> path(name.begin(), name.end());
+		path.push_back('\0');
+		files[k] = mkstemp(path.data());
+		if (files[k] < 0) { ok = false; break; }
+		unlink(path.data());
+
+		workers[k] = fork();
+		if (workers[k] < 0) { ok = false; break; }
+		if (workers[k] == 0) {
+			// Worker - calculate rows a block at a time, writing each out
+			int fd = files[k];
+			std::vector<double> ints, grads;
+			std::vector<int> indices, rowStart;
+			int nzeroes = 0;
+			std::vector<long long> counts(sweepCounts.size(), 0);
+			bool written = true;
+
+			for (int first = bounds[k]; first < bounds[k+1] && written; ){
+				int last = blockEnd(first, bounds[k+1], search.perRow);
+
+				ints.clear(); indices.clear(); rowStart.clear(); grads.clear();
+				overlapRows(first, last, search, ints, indices, rowStart, nzeroes, counts, grads);
+
+				long long header[3] = { first, last - first, (long long) ints.size() };
+				written = writeAll(fd, header, sizeof(header))
+					&& writeAll(fd, rowStart.data(), rowStart.size()*sizeof(int))
+					&& writeAll(fd, ints.data(), ints.size()*sizeof(double))
+					&& writeAll(fd, indices.data(), indices.size()*sizeof(int))
+					&& writeAll(fd, grads.data(), grads.size()*sizeof(double));
+				first = last;
+			}
+
+			long long end[4] = { -1, 0, 0, nzeroes };
+			written = written && writeAll(fd, end, sizeof(end))
+				&& writeAll(fd, counts.data(), counts.size()*sizeof(long long));
+			_exit(written ? 0 : 1);
+		}
+	}
+
+	// Coordinator - stitch each shard on in order
+	for (int k = 0; k < nworkers; k++){
+		if (workers[k] <= 0) continue;
+		int status;
+		bool done = (waitpid(workers[k], &status, 0) == workers[k])
+			&& WIFEXITED(status) && WEXITSTATUS(status) == 0;
+		ok = ok && done && lseek(files[k], 0, SEEK_SET) == 0;
+
+		long long header[3] = { 0, 0, 0 };
+		std::vector<double> ints, grads;
+		std::vector<int> indices, rowStart;
+		while (ok) {
+			ok = readAll(files[k], header, sizeof(header));
+			if (!ok || header[0] < 0) break;
+
+			rowStart.resize(header[1]);
+			ints.resize(header[2]);
+			indices.resize(header[2]);
+			grads.resize(gradient ? 3*header[2] : 0);
+			ok = readAll(files[k], rowStart.data(), header[1]*sizeof(int))
+				&& readAll(files[k], ints.data(), header[2]*sizeof(double))
+				&& readAll(files[k], indices.data(), header[2]*sizeof(int))
+				&& readAll(files[k], grads.data(), grads.size()*sizeof(double));
+			if (ok) storeRows(header[0], ints, indices, rowStart, grads);
+		}
+
+		if (ok) {
+			long long nzeroes;
+			std::vector<long long> counts(sweepCounts.size());
+			ok = readAll(files[k], &nzeroes, sizeof(nzeroes))
+				&& readAll(files[k], counts.data(), counts.size()*sizeof(long long));
+			zeroes += nzeroes;
+			for (int b = 0; b < counts.size(); b++) sweepCounts[b] += counts[b];
+		}
+	}
+
+	for (int k = 0; k < nworkers; k++)
+		if (files[k] >= 0) close(files[k]);
+
+	if (ok) finishOverlap();
+	else std::cerr << "Sharded overlap calculation failed.\n"
+				   << "Calculating the overlap serially instead.\n";
+	return ok;
+}
+
 // Calculate the sparsity
 double System::sparsity() const
 {
@@ -63,18 +778,19 @@ double System::sparsity() const
 	return 100.0*( zeroes / numEntries );
 }
 
-// Overloaded equals operator
-System& System::operator=(const System& other)
+// Set the thresholds at which to count zeroes, in addition to THRESHOLD
+void System::setSweep(const std::vector<double>& thresholds)
 {
-	// Copy N, threshold, zeroes
-	N = other.N;
-	THRESHOLD = other.THRESHOLD;
-	zeroes = other.zeroes;
-
-	// Deep copy gaussians
-	gaussians.clear();
-	for (int i = 0; i < other.gaussians.size(); i++)
-		gaussians.push_back(other.gaussians[i]);
+	sweepThresholds = thresholds;
+	std::sort(sweepThresholds.begin(), sweepThresholds.end());
+	sweepCounts.clear();
+}
 
-	return *this;
+// The number of integrals below the ith sweep threshold is the
+// total of all the histogram bins below it
+long long System::sweepZeroes(int i) const
+{
+	long long total = 0;
+	for (int b = 0; b <= i && b < sweepCounts.size(); b++) total += sweepCounts[b];
+	return total;
 }
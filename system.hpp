@@ -13,19 +13,121 @@
  *                      values, assuming that the 2N integers extra (see below) take
  *                      relatively little memory.  
  *              sIndices - vector of the matrix index of the corresponding sInt
+ *              sRowStart - the position in sInts of the first integral of each row
+ *                          of the lower triangle, with sRowStart[N] = sInts.size(),
+ *                          so that row i is sInts[sRowStart[i]] to sInts[sRowStart[i+1]-1]
  *              zeroes - a counter for the number of zero overlap elements
  *              THRESHOLD - the threshold under which the overlap integral is considered
  *                          to be zero.
+ *              sweepThresholds - extra thresholds (ascending) at which the zeroes
+ *                                are also counted, for a threshold sweep
+ *              sweepCounts - histogram of the magnitudes of all the integrals, where
+ *                            sweepCounts[b] is the number lying between sweep
+ *                            thresholds b-1 and b (from zero, up to infinity)
+ *              factors - a cache of the dense overlap matrix and its factorisations,
+ *                        shared by all orthogonalisations (see factorise.hpp)
+ *              nShards - the number of worker processes calcOverlap is split between
+ *              cell - the lattice vectors a1, a2, a3 (nine values) if the system is
+ *                     periodic, or empty for an isolated cluster. A periodic overlap
+ *                     integral S_ij is the sum, over lattice translations L, of the
+ *                     overlaps of gaussian i with gaussian j translated by L; each
+ *                     translated overlap below the threshold is screened out.
+ *              compressed - the integrals, if they are compressed (see storage.hpp),
+ *                           in which case sInts and sIndices are empty, and
+ *                           sRowStart counts integrals rather than positions
+ *                           in sInts; rows are best read with a RowReader
+ *              rowCache - if the system is lazy, the rows calculated so far (see
+ *                         storage.hpp), in place of any stored integrals
+ *              screen - whether calcOverlap finds the pairs that can reach the
+ *                       threshold from a spatial index, rather than looking at
+ *                       every pair (the integrals are the same either way)
+ *              grown - the search (see makeSearch) the row of each gaussian added
+ *                      after calcOverlap is found from: that of calcOverlap, if it
+ *                      made one, or else one made the first time a gaussian is
+ *                      added, and kept, so that each row is calculated from the
+ *                      gaussians near it, and those added since, alone
+ *              grownCounts - the sweep histogram of each row added, so that
+ *                            rolling back subtracts them without recalculating
+ *              sGrads - if the gradient is wanted, the derivatives of each non-zero
+ *                       integral S_ij (in the same order as the integrals) with
+ *                       respect to the x-, y-, and z-coordinates of gaussian i,
+ *                       three per integral; those with respect to gaussian j are
+ *                       their negatives. These are never compressed.
  *          routines:
  *              calcOverlap() - calculates the overlap integrals, and at the same time,
- *                              the number of zeroes in the overlap matrix.
+ *                              the number of zeroes in the overlap matrix. If nShards
+ *                              is more than one, the rows are split into that many
+ *                              shards, each calculated by a forked worker process and
+ *                              passed back through a spill file; this must be called
+ *                              before any other threads are started. If the system
+ *                              is lazy, this only makes an empty row cache, and each
+ *                              row is calculated when it is first read.
+ *              makeSearch(n, always) - makes the spatial index of the first n gaussians,
+ *                              the cutoff radius, and (if periodic) the lattice
+ *                              translations the rows are found from, once for all
+ *                              the rows calculated together, if they are screened
+ *                              or periodic (or always); blocks of rows, and shards,
+ *                              are then sized by the pairs expected in each row
+ *              searchZeta(search, zeta) - adds an exponent to a search, widening
+ *                              its cutoff radius if it is new
+ *              searchBox(search, first, last) - widens the box of a periodic search
+ *                              to hold gaussians first to last-1, finding the
+ *                              lattice translations again if they no longer reach
+ *              overlapRows(first, last, search, ...) - calculates a range of rows
+ *              periodicRows(first, last, search, ...) - as above, summing over lattice
+ *                              images found from the spatial index, so that only pairs
+ *                              within the cutoff radius of each other are calculated
+ *              screenedRows(first, last, search, ...) - as overlapRows, for an isolated
+ *                              cluster, calculating only the pairs found from a
+ *                              spatial index within the cutoff radius
  *              sparsity() - determines the sparsity (percentage of zeroes) of the overlap
  *                           matrix
+ *              addGaussian(g) - adds a gaussian; if the overlap has been calculated,
+ *                           its row is calculated and appended, the rows before it
+ *                           (e.g. of a fixed protein) being unchanged
+ *              snapshot() - a point to roll back to, e.g. before placing a ligand
+ *              rollback(mark) - removes every gaussian added since snapshot() gave
+ *                           mark, and their rows, so that many placements can share
+ *                           the calculation of the rows before them
+ *              removeGaussians(count) - removes the last count gaussians
+ *              growRow() - calculates and stores the row of the last gaussian, from
+ *                          the kept search, or in the kept row cache if lazy
+ *              setSweep(thresholds) - sets the sweep thresholds, before calcOverlap
+ *              setShards(n) - sets the number of worker processes, before calcOverlap
+ *              setCell(vectors) - makes the system periodic, before calcOverlap
+ *              setLazy(lazy, megabytes) - sets whether rows are calculated on demand,
+ *                              with a cache of at most megabytes, before calcOverlap
+ *              setCompression(compress, quantise) - sets whether the integrals are
+ *                              compressed, and quantised to within quantise *
+ *                              THRESHOLD, before calcOverlap
+ *              setScreening(screen) - sets whether calcOverlap searches a spatial
+ *                              index for the pairs to calculate
+ *              setGradient(gradient) - sets whether the gradient of the integrals
+ *                              is also calculated, before calcOverlap
+ *              getGradients(i) - the gradients of the integrals in row i
+ *              getNonZero() - the number of non-zero integrals stored
+ *              storage() - the number of bytes used to store them
+ *              sweepZeroes(i) - the number of zeroes at sweep threshold i
  *
  *
  * DATE         AUTHOR           CHANGES
  * ===========================================================================
  * 17/12/15     Robert Shaw      Original code. 
+ * 18/10/26     agent            Factorisation cache added.
+ * 18/10/26     agent            Row starts of the packed integrals stored.
+ * 18/10/26     agent            Threshold sweep histogram.
+ * 18/10/26     agent            Sharded calcOverlap over worker processes.
+ * 18/10/26     agent            Compressed storage of the integrals.
+ * 18/10/26     agent            Gradient of the integrals.
+ * 18/10/26     agent            Periodic lattice sums.
+ * 18/10/26     agent            Copies keep the integrals; move operations.
+ * 18/10/26     agent            Lazy rows, with a row cache.
+ * 19/10/26     agent            Spatially screened rows.
+ * 19/10/26     agent            Gaussians added and removed after calcOverlap.
+ * 19/10/26     agent            Periodic search made once per calcOverlap.
+ * 19/10/26     agent            Screened search made once; blocks of expected integrals.
+ * 19/10/26     agent            Search and row cache kept as gaussians are added and removed.
+ * 19/10/26     agent            Move operations defaulted; copy semantics documented.
  * 
  ************************************************************************************/
 
@@ -33,17 +135,81 @@
 #define SYSTEMHEADERDEF
 
 #include <vector>
+#include <memory>
 #include "gaussian.hpp"
 
+class FactorCache; // Forward declarations
+class CompressedRows;
+class RowCache;
+class SpatialIndex;
+
 class System
 {
 private:
 	int N, zeroes; // Number of gaussians, and zeroes in overlap matrix
 	std::vector<Gaussian> gaussians; // Gaussian functions
 	double THRESHOLD; // Threshold under which integrals are considered zero
+	std::vector<double> sweepThresholds; // Extra thresholds to count zeroes at
+	std::vector<long long> sweepCounts; // Histogram of integral magnitudes
+	int nShards; // Worker processes to calculate the overlap with
+	bool compress; // Whether to compress the integrals
+	double quantise; // Largest quantisation error, as a fraction of THRESHOLD
+	std::shared_ptr<CompressedRows> compressed; // The integrals, if compressed
+	bool gradient; // Whether to calculate the gradient of the integrals
+	std::vector<double> cell; // Lattice vectors, if periodic
+	bool lazy; // Whether rows are calculated when first read
+	double cacheSize; // Most MB of rows to keep, if lazy
+	std::shared_ptr<RowCache> rowCache; // The rows calculated so far, if lazy
+	bool screen; // Whether to calculate only the pairs found from a spatial index
+	std::shared_ptr<FactorCache> factors; // Cached dense overlap and factorisations
+
+	// What the rows are found from, made once for all the rows calculated together.
+	// Gaussians added after the index was made are looked at directly.
+	struct RowSearch {
+		std::shared_ptr<const SpatialIndex> index; // Of the gaussians, or null if not searched
+		int indexedN; // Number of gaussians in index, or -1 if no search was made
+		std::vector<double> indexedZetas; // Their distinct exponents
+		std::vector<double> zetas; // Those of all the gaussians searched for
+		double cutoff; // Cutoff radius between any two of those, for the smallest threshold wanted
+		double perRow; // Pairs each row is expected to look at, or 0 if every pair
+		double lo[3], hi[3]; // Box around the gaussians (at least), if periodic
+		double reach; // Length of the longest lattice translation in shifts
+		std::vector<double> shifts; // Lattice translations that could bring any two within cutoff
+
+		RowSearch() : indexedN(-1), cutoff(0.0), perRow(0.0), lo{0.0, 0.0, 0.0}, hi{0.0, 0.0, 0.0},
+					  reach(0.0) {}
+	};
+	RowSearch grown; // For the rows of gaussians added after calcOverlap
+	std::vector<long long> grownCounts; // Sweep histogram of each of those rows, in turn
+
+	RowSearch makeSearch(int n, bool always = false) const;
+	void searchZeta(RowSearch& search, double zeta) const;
+	void searchBox(RowSearch& search, int first, int last) const;
+
+	void overlapRows(int first, int last, const RowSearch& search, std::vector<double>& ints,
+					 std::vector<int>& indices, std::vector<int>& rowStart, int& nzeroes,
+					 std::vector<long long>& counts, std::vector<double>& grads) const;
+	void periodicRows(int first, int last, const RowSearch& search, std::vector<double>& ints,
+					  std::vector<int>& indices, std::vector<int>& rowStart, int& nzeroes,
+					  std::vector<long long>& counts, std::vector<double>& grads) const;
+	void screenedRows(int first, int last, const RowSearch& search, std::vector<double>& ints,
+					  std::vector<int>& indices, std::vector<int>& rowStart, int& nzeroes,
+					  std::vector<long long>& counts, std::vector<double>& grads) const;
+	void candidateRow(int i, const std::vector<int>& candidates, std::vector<double>& ints,
+					  std::vector<int>& indices, int& nzeroes, std::vector<long long>& counts,
+					  std::vector<double>& grads) const;
+	double screenThreshold() const; // The smallest threshold wanted
+	void growRow();
+	bool calcOverlapSharded(const RowSearch& search); // Returns false, having stored nothing, if it fails
+	void clearOverlap();
+	void storeRows(int first, const std::vector<double>& ints, const std::vector<int>& indices,
+				   const std::vector<int>& rowStart, const std::vector<double>& grads);
+	void finishOverlap();
 public:
 	std::vector<double> sInts; // All non-zero overlap integrals
 	std::vector<int> sIndices; // The indices of the non-zero overlap integrals
+	std::vector<int> sRowStart; // Where each row of the lower triangle starts in sInts
+	std::vector<double> sGrads; // Gradients of the non-zero integrals, if wanted
 
 	System(double THRESHOLD_); // Constructor
 
@@ -52,13 +218,71 @@ public:
 	int getZeroes() const { return zeroes; }
 	double getThreshold() const { return THRESHOLD; }
 	const Gaussian& getGaussian(int i) const { return gaussians[i]; }
+	FactorCache& getFactors() const { return *factors; }
+	bool hasOverlap() const { return sRowStart.size() == N+1; } // calcOverlap has been done
+	bool hasRows() const { return hasOverlap() || rowCache; } // Rows can be read, if only lazily
+	const std::vector<double>& getSweepThresholds() const { return sweepThresholds; }
+	const std::vector<long long>& getSweepCounts() const { return sweepCounts; }
+	int getShards() const { return nShards; }
+	bool isPeriodic() const { return !cell.empty(); }
+	const std::vector<double>& getCell() const { return cell; }
+	const CompressedRows* getCompressed() const { return compressed.get(); }
+	RowCache* getRowCache() const { return rowCache.get(); }
+	bool isLazy() const { return lazy; }
+	double getCacheSize() const { return cacheSize; }
+	bool isScreened() const { return screen; }
+	bool isCompressed() const { return compress; }
+	bool hasGradient() const { return gradient && hasOverlap(); }
+	// The gradients of the integrals in row i, three for each, if calculated
+	const double* getGradients(int i) const { return sGrads.data() + 3*(std::size_t) sRowStart[i]; }
+	long long getNonZero() const;
+	double storage() const;
 	
 	void addGaussian(Gaussian g_); // Adds a Gaussian function to the System
+	int snapshot() const { return N; } // A point to roll back to
+	void rollback(int mark); // Removes the Gaussians added since the snapshot mark
+	void removeGaussians(int count) { rollback(N - count); } // Removes the last count
 	void calcOverlap(); // Calculates the overlap matrix, determines no. of zeroes
 	double sparsity() const; // Calculates the sparsity of the overlap matrix
 
-	// Overload the equals operator
-	System& operator=(const System& other);
+	// Threshold sweep - thresholds must be set before calcOverlap
+	void setSweep(const std::vector<double>& thresholds);
+	long long sweepZeroes(int i) const; // Zeroes at the ith (ascending) sweep threshold
+
+	// Number of worker processes for calcOverlap (1 to calculate in this process)
+	void setShards(int n) { nShards = (n > 1 ? n : 1); }
+
+	// Make the system periodic, with lattice vectors a1, a2, a3 given in turn as
+	// nine values (or an isolated cluster, if empty); returns false, leaving
+	// the system unchanged, if they do not span space
+	bool setCell(const std::vector<double>& vectors);
+
+	// Compress the integrals, quantised to within quantise_ * THRESHOLD if
+	// quantise_ > 0, or stored exactly otherwise
+	void setCompression(bool compress_, double quantise_ = 0.0);
+
+	// Calculate each row only when it is first read, keeping at most
+	// megabytes of them in a cache, rather than all of them up front
+	void setLazy(bool lazy_, double megabytes = 64.0);
+
+	// Find the pairs of gaussians that can reach the threshold from a spatial
+	// index, rather than looking at every pair, in calcOverlap
+	void setScreening(bool screen_) { screen = screen_; }
+
+	// Also calculate the gradient of the integrals with respect to the
+	// coordinates of the gaussians, in the same pass
+	void setGradient(bool gradient_) { gradient = gradient_; }
+
+	// Copies are cheap where they can be: the plain integrals (sInts, ...) are
+	// copied, but the compressed integrals, the row cache, the cached factorisations
+	// and the spatial index of the grown search are shared. Whichever System changes
+	// first (calcOverlap, addGaussian, rollback, ...) makes its own, so neither sees
+	// the other change; only reads of a shared row cache are shared, which are safe.
+	// Moves take everything, leaving other fit only to be assigned to or destroyed.
+	System(const System& other) = default;
+	System(System&& other) = default;
+	System& operator=(const System& other) = default;
+	System& operator=(System&& other) = default;
 };
 
 #endif
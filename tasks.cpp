@@ -0,0 +1,140 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement classes ThreadPool and TaskGraph
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ *
+ ***************************************************************************************/
+
+#include "tasks.hpp"
+
+// Number of hardware threads, or one if this cannot be determined
+int defaultThreads()
+{
+	int n = std::thread::hardware_concurrency();
+	return (n > 0 ? n : 1);
+}
+
+// Constructor - start the workers
+ThreadPool::ThreadPool(int nthreads) : active(0), stopping(false)
+{
+	if (nthreads < 1) nthreads = 1;
+	for (int i = 0; i < nthreads; i++)
+		workers.push_back(std::thread(&ThreadPool::work, this));
+}
+
+// Destructor - let the workers drain the queue, then join them
+ThreadPool::~ThreadPool()
+{
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		stopping = true;
+	}
+	available.notify_all();
+	for (int i = 0; i < workers.size(); i++) workers[i].join();
+}
+
+// Worker loop - take tasks from the front of the queue until told to stop
+void ThreadPool::work()
+{
+	std::function<void()> task;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			available.wait(guard, [this]{ return stopping || !queue.empty(); });
+			if (queue.empty()) return; // Stopping, and nothing left to do
+			task = std::move(queue.front());
+			queue.pop_front();
+			active++;
+		}
+
+		task();
+
+		{
+			std::unique_lock<std::mutex> guard(lock);
+			active--;
+			if (active == 0 && queue.empty()) idle.notify_all();
+		}
+	}
+}
+
+// Add a task to the back of the queue
+void ThreadPool::submit(std::function<void()> task)
+{
+	{
+		std::unique_lock<std::mutex> guard(lock);
+		queue.push_back(std::move(task));
+	}
+	available.notify_one();
+}
+
+// Block until there is nothing queued or running
+void ThreadPool::wait()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	idle.wait(guard, [this]{ return active == 0 && queue.empty(); });
+}
+
+// Constructor
+TaskGraph::TaskGraph() : finished(0)
+{
+}
+
+// Add a task, recording it as a dependent of each of its dependencies
+int TaskGraph::addTask(std::function<void()> task, ThreadPool& pool,
+					   const std::vector<int>& deps)
+{
+	int id = nodes.size();
+
+	Node node;
+	node.task = std::move(task);
+	node.pool = &pool;
+	node.waiting = deps.size();
+	nodes.push_back(node);
+
+	for (int i = 0; i < deps.size(); i++)
+		nodes[deps[i]].dependents.push_back(id);
+
+	return id;
+}
+
+// Submit a task, wrapped so that on completion it releases its dependents
+void TaskGraph::launch(int id)
+{
+	nodes[id].pool->submit([this, id]{
+			nodes[id].task();
+			nodes[id].task = nullptr; // Release anything the task captured
+
+			std::vector<int> ready;
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				for (int i = 0; i < nodes[id].dependents.size(); i++){
+					int d = nodes[id].dependents[i];
+					if (--nodes[d].waiting == 0) ready.push_back(d);
+				}
+				finished++;
+				// Notify while holding the lock, so run() cannot return
+				// (and the graph be destroyed) before this is done
+				done.notify_all();
+			}
+			for (int i = 0; i < ready.size(); i++) launch(ready[i]);
+		});
+}
+
+// Start every task without dependencies, then wait for all to finish
+void TaskGraph::run()
+{
+	finished = 0;
+
+	// Find all the starting tasks before launching any, as the
+	// waiting counts change as soon as tasks start to finish
+	std::vector<int> roots;
+	for (int i = 0; i < nodes.size(); i++)
+		if (nodes[i].waiting == 0) roots.push_back(i);
+	for (int i = 0; i < roots.size(); i++) launch(roots[i]);
+
+	std::unique_lock<std::mutex> guard(lock);
+	done.wait(guard, [this]{ return finished == nodes.size(); });
+}
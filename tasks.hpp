@@ -0,0 +1,100 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To provide a simple thread pool, and a task graph built on top of it,
+ *          so that independent commands (and their output) can be run concurrently.
+ *
+ * CONTAINS:
+ *          class ThreadPool:
+ *              data:
+ *                  workers - the threads servicing the queue
+ *                  queue - the tasks waiting to be run
+ *              routines:
+ *                  submit(task) - adds a task to the queue
+ *                  wait() - blocks until the queue is empty and all workers are idle
+ *                  getNThreads() - the number of worker threads
+ *
+ *          class TaskGraph:
+ *              data:
+ *                  nodes - the tasks, the pool each runs on, and their dependents
+ *              routines:
+ *                  addTask(task, pool, deps) - adds a task that may only start once
+ *                                              all tasks in deps have finished, and
+ *                                              returns its id
+ *                  run() - runs every task, respecting dependencies, and blocks
+ *                          until all have finished
+ *
+ *          defaultThreads() - the number of hardware threads (at least 1)
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 18/10/26     agent            Original code.
+ *
+ ************************************************************************************/
+
+#ifndef TASKSHEADERDEF
+#define TASKSHEADERDEF
+
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Number of threads to use when none is specified
+int defaultThreads();
+
+class ThreadPool
+{
+private:
+	std::vector<std::thread> workers; // Worker threads
+	std::deque<std::function<void()> > queue; // Tasks waiting to run
+	std::mutex lock; // Guards queue, active, stopping
+	std::condition_variable available; // Signalled when a task is queued
+	std::condition_variable idle; // Signalled when a worker goes idle
+	int active; // Number of tasks currently running
+	bool stopping; // Set when the pool is being destroyed
+
+	void work(); // Main loop of each worker
+public:
+	ThreadPool(int nthreads); // Constructor - starts nthreads workers
+	~ThreadPool(); // Destructor - finishes queued tasks and joins workers
+
+	int getNThreads() const { return workers.size(); }
+
+	void submit(std::function<void()> task); // Queue a task
+	void wait(); // Block until all queued tasks have finished
+
+	// The pool owns threads, so cannot be copied
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+};
+
+class TaskGraph
+{
+private:
+	struct Node {
+		std::function<void()> task;
+		ThreadPool* pool; // The pool the task is submitted to
+		int waiting; // Number of unfinished dependencies
+		std::vector<int> dependents; // Tasks that depend on this one
+	};
+	std::vector<Node> nodes;
+	std::mutex lock; // Guards waiting counts and finished
+	std::condition_variable done; // Signalled when a task finishes
+	int finished; // Number of tasks that have finished
+
+	void launch(int id); // Submit task id to its pool
+public:
+	TaskGraph();
+
+	// Add a task to be run on pool once all of deps have finished.
+	// Dependencies must already have been added. Returns the task id.
+	int addTask(std::function<void()> task, ThreadPool& pool,
+				const std::vector<int>& deps = std::vector<int>());
+
+	// Run all tasks, blocking until every one has finished
+	void run();
+};
+
+#endif
@@ -0,0 +1,91 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement the orthogonalisation of local windows of basis functions
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ * 18/10/26       agent              Rows read through a RowReader.
+ * 19/10/26       agent              Columns read through RowReader::col.
+ *
+ ***************************************************************************************/
+
+#include "windows.hpp"
+#include "system.hpp"
+#include "spatial.hpp"
+#include "factorise.hpp"
+#include "storage.hpp"
+#include "orthogonalise.hpp"
+#include <Eigen/Eigenvalues>
+#include <algorithm>
+#include <iostream>
+
+// Build a window around every stride-th function, using a spatial
+// index so that only nearby cells are searched for each
+std::vector<Window> radiusWindows(const System& sys, double radius, int stride)
+{
+	if (stride < 1) stride = 1;
+
+	std::vector<Window> windows;
+	SpatialIndex index(sys, radius);
+	for (int i = 0; i < sys.getN(); i += stride){
+		const Gaussian& g = sys.getGaussian(i);
+		Window w;
+		w.centre = i;
+		index.near(sys, g.getCoord(0), g.getCoord(1), g.getCoord(2), radius, w.indices);
+		std::sort(w.indices.begin(), w.indices.end());
+		windows.push_back(w);
+	}
+	return windows;
+}
+
+// The columns of each row of the lower triangle are in ascending order, as are
+// the functions in the window, so the integrals needed from row i are found by
+// merging the two
+void windowOverlap(const System& sys, const Window& w, Eigen::MatrixXd& S)
+{
+	int n = w.indices.size();
+	S.setZero(n, n);
+
+	RowReader reader(sys);
+	for (int a = 0; a < n; a++){
+		int count = reader.read(w.indices[a]);
+		int k = 0;
+		for (int b = 0; b <= a && k < count; b++){
+			while (k < count && reader.col(k) < w.indices[b]) k++;
+			if (k < count && reader.col(k) == w.indices[b]) {
+				S(a, b) = reader.vals[k];
+				S(b, a) = S(a, b);
+			}
+		}
+	}
+}
+
+// Orthogonalise a window, factorising its own overlap matrix
+bool orthogonaliseWindow(const System& sys, const Window& w, const int method,
+						 Eigen::MatrixXd& f)
+{
+	Eigen::MatrixXd S;
+	windowOverlap(sys, w, S);
+
+	// As in orthogonalise, the coefficients are the identity,
+	// as the basis functions are the centres
+	Coefficients P(S.rows());
+
+	if (method == GRAM_SCHMIDT) {
+		Eigen::LLT<Eigen::MatrixXd> lltOfS(S);
+		if (lltOfS.info() != Eigen::Success) return false;
+		gramSchmidt(lltOfS.matrixLLT(), P, f);
+		return true;
+	}
+
+	Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> solver(S);
+	if (solver.info() != Eigen::Success) return false;
+	EigenPairs eig;
+	eig.values = solver.eigenvalues();
+	eig.vectors = solver.eigenvectors();
+
+	if (method == SYM_LOWDIN) symLowdin(eig, P, f);
+	else canonical(eig, P, f);
+	return true;
+}
@@ -0,0 +1,54 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To orthogonalise local windows of basis functions - for example each
+ *          function together with its neighbours within a radius, or explicit lists
+ *          of functions - rather than only the first n functions in input order.
+ *
+ *          The overlap matrix of each window is extracted directly from the stored
+ *          integrals of the System, so the full dense overlap matrix is never formed,
+ *          and each window is factorised independently, so that many windows can be
+ *          orthogonalised concurrently.
+ *
+ * CONTAINS:
+ *          struct Window - the (0-based, ascending) indices of the functions in a
+ *                          window, and the function it is centred on (-1 if none)
+ *          radiusWindows(sys, radius, stride) - one window for every stride-th
+ *                                               function, holding all the functions
+ *                                               within radius of it
+ *          windowOverlap(sys, w, S) - the overlap matrix of the functions in w
+ *          orthogonaliseWindow(sys, w, method, f) - orthogonalise the functions in w
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 18/10/26     agent            Original code.
+ *
+ ************************************************************************************/
+
+#ifndef WINDOWSHEADERDEF
+#define WINDOWSHEADERDEF
+
+#include <vector>
+#include <Eigen/Dense>
+
+// Declare forward dependencies
+class System;
+
+struct Window
+{
+	std::vector<int> indices; // Functions in the window, ascending
+	int centre; // Function the window was built around, or -1 for a list
+};
+
+// Windows of all the functions within radius of every stride-th function
+std::vector<Window> radiusWindows(const System& sys, double radius, int stride = 1);
+
+// Form the dense overlap matrix of the functions in w, from the stored integrals
+void windowOverlap(const System& sys, const Window& w, Eigen::MatrixXd& S);
+
+// Orthogonalise the functions in w by the given method, writing the
+// coefficients into f. Returns false if this was not possible (e.g.
+// the window's overlap matrix is not positive definite for Gram-Schmidt).
+bool orthogonaliseWindow(const System& sys, const Window& w, const int method,
+						 Eigen::MatrixXd& f);
+
+#endif
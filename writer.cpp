@@ -0,0 +1,128 @@
+/***************************************************************************************
+ *
+ * PURPOSE: To implement class TextWriter
+ *
+ * DATE           AUTHOR             CHANGES
+ * ======================================================================
+ * 18/10/26       agent              Original code.
+ *
+ ***************************************************************************************/
+
+#include "writer.hpp"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <cstdio>
+
+// Longest single number formatted, before padding
+const std::size_t MAX_FIELD = 64;
+
+// Constructor - starts the writer thread
+TextWriter::TextWriter(std::ostream& out_, std::size_t capacity) : out(out_), used(0),
+																	toWrite(0), stopping(false)
+{
+	capacity = std::max(capacity, (std::size_t) 4096);
+	filling.resize(capacity);
+	writing.resize(capacity);
+	writer = std::thread(&TextWriter::work, this);
+}
+
+TextWriter::~TextWriter()
+{
+	finish();
+}
+
+// Write each buffer as it is handed over, until stopped
+void TextWriter::work()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	while (true) {
+		changed.wait(guard, [this]{ return toWrite > 0 || stopping; });
+		if (toWrite == 0) break; // Stopping, with nothing left to write
+
+		// The buffer being written is not touched by the formatting
+		// thread until toWrite is reset, so need not be locked
+		guard.unlock();
+		out.write(writing.data(), toWrite);
+		guard.lock();
+
+		toWrite = 0;
+		changed.notify_all();
+	}
+}
+
+// Wait for the last buffer to be written, then hand over the one just filled
+void TextWriter::handOver()
+{
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [this]{ return toWrite == 0; });
+	filling.swap(writing);
+	toWrite = used;
+	used = 0;
+	changed.notify_all();
+}
+
+char* TextWriter::reserve(std::size_t n)
+{
+	if (used + n > filling.size()) handOver();
+	return filling.data() + used;
+}
+
+// Append a string of any length, a buffer at a time
+void TextWriter::put(const char* s, std::size_t n)
+{
+	while (n > 0) {
+		if (used == filling.size()) handOver();
+		std::size_t chunk = std::min(n, filling.size() - used);
+		std::memcpy(filling.data() + used, s, chunk);
+		used += chunk;
+		s += chunk; n -= chunk;
+	}
+}
+
+// Right-align the text just formatted at p, of length len, in a field
+// of the given width, as std::setw does
+static std::size_t pad(char* p, std::size_t len, int width)
+{
+	if (width <= 0 || len >= (std::size_t) width) return len;
+	std::size_t spaces = width - len;
+	std::memmove(p + spaces, p, len);
+	std::memset(p, ' ', spaces);
+	return width;
+}
+
+void TextWriter::putInt(long long v, int width)
+{
+	char* p = reserve(MAX_FIELD + std::max(width, 0));
+	std::to_chars_result r = std::to_chars(p, p + MAX_FIELD, v);
+	used += pad(p, r.ptr - p, width);
+}
+
+// As a stream does by default (neither fixed nor scientific), this is %g
+void TextWriter::putDouble(double v, int width, int precision)
+{
+	char* p = reserve(MAX_FIELD + std::max(width, 0));
+	std::size_t len;
+#if defined(__cpp_lib_to_chars)
+	std::to_chars_result r = std::to_chars(p, p + MAX_FIELD, v, std::chars_format::general, precision);
+	len = r.ptr - p;
+#else
+	// Standard libraries without floating-point to_chars
+	len = snprintf(p, MAX_FIELD, "%.*g", precision, v);
+#endif
+	used += pad(p, len, width);
+}
+
+// Hand over whatever is left, then stop the writer once it has written it
+void TextWriter::finish()
+{
+	if (!writer.joinable()) return;
+	if (used > 0) handOver();
+
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	changed.notify_all();
+	writer.join();
+}
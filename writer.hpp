@@ -0,0 +1,72 @@
+/*************************************************************************************
+ *
+ * PURPOSE: To format large amounts of text output (e.g. every non-zero integral)
+ *          quickly, and write it to file while the rest is still being formatted.
+ *
+ *          Numbers are formatted with std::to_chars, straight into a large buffer,
+ *          rather than through the stream manipulators. The text is identical to
+ *          that of a stream, i.e. right-aligned in a field of the given width, with
+ *          doubles in the default (%g) notation to the given precision. When the
+ *          buffer is full, it is handed to a background thread to write, and the
+ *          formatting carries on into a second buffer, so that formatting and
+ *          writing overlap.
+ *
+ * CONTAINS:
+ *          class TextWriter:
+ *              data:
+ *                  out - the stream written to; nothing else may write to it until
+ *                        finish() has been called
+ *                  filling - the buffer being formatted into
+ *                  writing - the buffer being written by the background thread
+ *              routines:
+ *                  put(s) - append a string, or a character
+ *                  putInt(v, width) - append an integer, right-aligned in width
+ *                  putDouble(v, width, precision) - as above, for a double
+ *                  finish() - write out everything appended, and stop the thread
+ *                             (also done by the destructor)
+ *
+ * DATE         AUTHOR           CHANGES
+ * ===========================================================================
+ * 18/10/26     agent            Original code.
+ *
+ ************************************************************************************/
+
+#ifndef WRITERHEADERDEF
+#define WRITERHEADERDEF
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstddef>
+
+class TextWriter
+{
+private:
+	std::ostream& out;
+	std::vector<char> filling, writing; // The two buffers, each of the capacity
+	std::size_t used, toWrite; // Characters in filling, and in writing
+	std::thread writer; // Background thread writing out the buffers
+	std::mutex lock; // Guards toWrite and stopping
+	std::condition_variable changed; // Signalled when either changes
+	bool stopping; // Set once everything has been handed over
+
+	void work(); // Main loop of the writer thread
+	void handOver(); // Swap the buffers, once the last has been written
+	char* reserve(std::size_t n); // Space for n more characters
+public:
+	TextWriter(std::ostream& out_, std::size_t capacity = 1 << 20);
+	~TextWriter();
+
+	void put(const char* s, std::size_t n);
+	void put(const std::string& s) { put(s.data(), s.size()); }
+	void put(char c) { *reserve(1) = c; used++; }
+	void putInt(long long v, int width);
+	void putDouble(double v, int width, int precision);
+
+	void finish();
+};
+
+#endif